@@ -0,0 +1,19 @@
+#
+# Writes a large COOL program for timing cgen (make bench-output): n
+# classes in a tree under IO, each with an Int and a String attribute and
+# m pairs of methods using let, while, if, arithmetic and case.
+#
+# usage: awk -v n=100 -v m=10 -f bench.awk > bench.cl
+#
+BEGIN {
+    for (i = 0; i < n; i++) {
+        printf "class C%d inherits %s {\n", i, i == 0 ? "IO" : "C" int((i - 1) / 4)
+        printf "    a%d : Int <- %d;\n    b%d : String <- \"c%d\";\n", i, i, i, i
+        for (j = 0; j < m; j++) {
+            printf "    m%d_%d(x : Int, y : Int) : Int { let t : Int <- x * y + a%d in { while t < 100 loop t <- t + %d pool; if t = y then t - x else t + x fi; } };\n", i, j, i, j + 1
+            printf "    s%d_%d(o : Object) : Object { case o of n : Int => n + n * %d - %d; s : String => s.concat(b%d); p : Object => p; esac };\n", i, j, j, i, i
+        }
+        printf "};\n"
+    }
+    printf "class Main inherits IO {\n    main() : Object { out_int((new C%d).m%d_0(1, 2)) };\n};\n", n - 1, n - 1
+}
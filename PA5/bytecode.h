@@ -0,0 +1,131 @@
+///////////////////////////////////////////////////////////////////////
+//
+//  Bytecode backend (cgen -b): the program is compiled to bytecode
+//  for an accumulator machine and run in-process by the VM in vm.cc.
+//
+//  Classes are numbered by their tags, dispatch tables hold method
+//  numbers in the order of GetDispatchIdxTab, and attributes are the
+//  fields of an object in the order of GetAttribIdxTab.
+//
+///////////////////////////////////////////////////////////////////////
+
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <iostream>
+
+//
+// Values are tagged words: void is 0, an Int is its value shifted left
+// by 2 with tag 1, a Bool likewise with tag 2, and anything else is a
+// pointer to an object in the heap.
+//
+typedef uint64_t BcValue;
+
+#define BC_VOID        ((BcValue)0)
+#define BC_TAG_MASK    3
+#define BC_INT_TAG     1
+#define BC_BOOL_TAG    2
+
+//
+// Opcodes and their number of operands, which follow them in the code.
+// Binary operations take their first operand from the stack, which they
+// pop, and the second from the accumulator. Jump targets are offsets in
+// the code.
+//
+#define BC_OPCODES(X)                                                     \
+    X(LOAD_VOID, 0)                                                       \
+    X(LOAD_SELF, 0)                                                       \
+    X(LOAD_CONST, 1)        /* constant */                                \
+    X(LOAD_LOCAL, 1)        /* local: params, then let vars */            \
+    X(STORE_LOCAL, 1)       /* local */                                   \
+    X(LOAD_ATTR, 1)         /* attribute */                               \
+    X(STORE_ATTR, 1)        /* attribute */                               \
+    X(PUSH, 0)                                                            \
+    X(ADD, 0)                                                             \
+    X(SUB, 0)                                                             \
+    X(MUL, 0)                                                             \
+    X(DIV, 0)                                                             \
+    X(NEG, 0)                                                             \
+    X(LT, 0)                                                              \
+    X(LEQ, 0)                                                             \
+    X(EQ, 0)                                                              \
+    X(NOT, 0)                                                             \
+    X(ISVOID, 0)                                                          \
+    X(JUMP, 1)              /* target */                                  \
+    X(JUMP_FALSE, 1)        /* target */                                  \
+    X(JUMP_TAG_OUT, 3)      /* lo, hi, target: unless tag in [lo, hi] */  \
+    X(CASE_VOID, 1)         /* line: abort if void */                     \
+    X(CASE_ABORT, 0)                                                      \
+    X(NEW, 1)               /* class, whose init is then called */        \
+    X(NEW_SELF, 0)                                                        \
+    X(DISPATCH, 3)          /* dispatch index, arg num, line */           \
+    X(CALL, 3)              /* method, arg num, line */                   \
+    X(RETURN, 0)
+
+enum BcOp {
+#define BC_ENUM(name, operand_num) BC_##name,
+    BC_OPCODES(BC_ENUM)
+#undef BC_ENUM
+    BC_OP_NUM
+};
+
+// The methods of the runtime, implemented by the VM.
+enum BcNative {
+    BC_NOT_NATIVE = -1,
+    BC_OBJECT_ABORT,
+    BC_OBJECT_TYPE_NAME,
+    BC_OBJECT_COPY,
+    BC_IO_OUT_STRING,
+    BC_IO_OUT_INT,
+    BC_IO_IN_STRING,
+    BC_IO_IN_INT,
+    BC_STRING_LENGTH,
+    BC_STRING_CONCAT,
+    BC_STRING_SUBSTR
+};
+
+struct BcConst {
+    enum Kind { INT, BOOL, STRING };
+    Kind kind;
+    int val;
+    std::string str;
+};
+
+struct BcMethod {
+    std::string name;         // <classname>.<method>
+    int arg_num;
+    int slot_num;             // let vars and case branches
+    int push_num;             // most values it has pushed at once
+    int entry;                // offset of the code
+    BcNative native;
+    int filename;             // constant, for the aborts
+};
+
+struct BcClass {
+    std::string name;
+    int name_const;           // constant holding the name
+    int init;                 // method, -1 if there is nothing to do
+    std::vector<int> disp;    // methods
+    std::vector<int> attrs;   // default value of each attribute: a
+                              // constant, or -1 for void
+};
+
+struct BcProgram {
+    std::vector<int> code;
+    std::vector<BcConst> consts;
+    std::vector<BcMethod> methods;
+    std::vector<BcClass> classes;
+    int int_tag;
+    int bool_tag;
+    int string_tag;
+    int main_class;
+    int main_method;
+};
+
+// Runs program, writing its output to out. Returns the exit status.
+int RunBytecode(const BcProgram& program, std::ostream& out, bool count_ops);
+
+#endif
@@ -14,6 +14,9 @@ extern int ast_yyparse(void); // entry point to the AST parser
 int cool_yydebug;     // not used, but needed to link with handle_flags
 char *curr_filename;
 
+extern int cgen_bytecode;
+extern int cgen_bytecode_status;
+
 void handle_flags(int argc, char *argv[]);
 
 int main(int argc, char *argv[]) {
@@ -22,6 +25,20 @@ int main(int argc, char *argv[]) {
   handle_flags(argc,argv);
   firstfile_index = optind;
 
+  //
+  // The bytecode is run rather than written, and the program may read
+  // standard input, so the AST is then read from the named file.
+  //
+  if (cgen_bytecode) {
+      if (optind < argc && !(ast_file = fopen(argv[optind], "r"))) {
+	  cerr << "Cannot open AST file " << argv[optind] << endl;
+	  exit(1);
+      }
+      ast_yyparse();
+      ast_root->cgen(cout);
+      return cgen_bytecode_status;
+  }
+
   if (!out_filename && optind < argc) {   // no -o option
       char *dot = strrchr(argv[optind], '.');
       if (dot) *dot = '\0'; // strip off file extension
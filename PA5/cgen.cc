@@ -22,20 +22,136 @@
 //**************************************************************
 
 #include <string>
+#include <cstring>
+#include <sstream>
+#include <fstream>
 #include <vector>
 #include <algorithm>
 #include <map>
+#include <set>
+#include <iterator>
 #include <stack>
+#include <tuple>
+#include <thread>
+#include <atomic>
 
 #include "cgen.h"
 #include "cgen_gc.h"
+#include "bytecode.h"
 
 extern void emit_string_constant(ostream& str, char* s);
 extern int cgen_debug;
+extern int cgen_optimize;
+extern int cgen_regargs;
+extern int cgen_compact;
+extern int cgen_unbuffered;
+extern int cgen_x86;
+extern int cgen_bytecode;
+extern int cgen_bytecode_counts;
+extern int cgen_profile;
+extern char* cgen_profile_file;
+
+// The inits and methods of each class are generated by one of several
+// threads (see code_class_text), so the state of code generation is per
+// thread. Labels are numbered per class and prefixed by its name, which
+// makes the output the same however the classes are spread over threads.
+static thread_local const char* label_scope = "";
+
+// Methods whose bodies are being generated: the current method followed by
+// any calls inlined into it, innermost last.
+static thread_local std::vector<method_class*> inline_stack;
+static const int INLINE_SIZE_BUDGET = 8;
+
+// Label at the start of the current method's body, after the prologue;
+// -1 unless a self-recursive tail call jumps to it.
+static thread_local int body_label = -1;
+
+// What the body being generated needs of its frame (see emit_frame),
+// noted by the emitters as it is generated: whether it makes calls, or
+// restores $ra for a tail call, and whether it uses $s0 or $fp.
+struct FrameUse {
+    bool calls;
+    bool self;
+    bool fp;
+};
+static thread_local FrameUse frame_use;
+
+// Calls to the runtime abort routines are cold, so they are emitted out of
+// line after all the methods and reached by a single forward branch. Stubs
+// with the same routine, file and line are shared.
+struct AbortStub {
+    const char* scope;
+    int label;
+    const char* routine;
+    StringEntry* filename;
+    int line;
+};
+
+// Register arguments. With -a the first REG_ARG_NUM actuals of a call are
+// passed in $a1-$a3 and only the rest are pushed. The runtime's methods
+// still take theirs on the stack and are called through adapters.
+static const int REG_ARG_NUM = 3;
+static const char* const ARG_REGS[REG_ARG_NUM] = { A1, A2, A3 };
+
+static int GetRegArgNum(int arg_num) {
+    return cgen_regargs ? std::min(arg_num, REG_ARG_NUM) : 0;
+}
+
+static int GetStackArgNum(int arg_num) {
+    return arg_num - GetRegArgNum(arg_num);
+}
+
+// With -P every method counts its calls and every new its objects, each
+// in a word of the counter table of the class being generated, which is
+// emitted with the constants, along with names for them (see
+// code_profile_tables). The allocation sites are numbered as they are
+// generated, after the methods of the class. The program never prints
+// the counters: only mipsim reports them, when the program ends.
+static thread_local int profile_method_num = 0;
+
+// What generating code has used and left to emit, which the threads merge
+// once all the classes are generated. A method body can be generated again
+// from a copy taken before it (see method_class::code).
+struct GenState {
+    int labelnum = 0;
+    std::vector<AbortStub> abort_stubs;
+    std::map<std::tuple<std::string, StringEntry*, int>, int> abort_stub_labels;
+    // Only the constants that are referenced are emitted, keeping the
+    // names given by their indices in the tables.
+    std::set<StringEntry*> used_str_consts;
+    std::set<IntEntry*> used_int_consts;
+    bool int_pool_used = false;
+    // Write barriers for the generational collector, reported with -c.
+    int write_barriers_emitted = 0;
+    int write_barriers_elided = 0;
+    std::vector<ProfileSite> profile_sites;
+};
+static thread_local GenState gen_state;
+
+// The receivers seen at each dispatch site, read from the profile given
+// with -F, which mipsim -d writes from the counters of -P.
+static std::map<std::string, std::vector<std::pair<int, CgenNode*>>> receiver_profile;
+
+// At most this many receiver classes are speculated on at a dispatch,
+// each only if at least a third of the calls there go to it.
+static const int SPECULATION_MAX = 2;
+
+// Escape analysis (-O). The lets and calls that own an object allocated
+// in the frame, mapped to its new, and the classes whose methods may run
+// on such an object: those allocated there and their ancestors. Both are
+// found before the classes are generated and only read after.
+static std::map<Expression, new__class*> stack_object_owners;
+static std::set<CgenNode*> stack_object_classes;
+
+// The first slot of each object to be allocated in the frame being
+// generated, set by its owner and taken by its new.
+static thread_local std::map<new__class*, int> stack_object_slots;
 
-int labelnum = 0;
 CgenClassTable* codegen_classtable = nullptr;
 
+// The exit status of the program that -b has run, which cgen exits with.
+int cgen_bytecode_status = 0;
+
 //
 // Three symbols from the semantic analyzer (semant.cc) are used.
 // If e : No_type, then no code is generated for e.
@@ -136,13 +252,130 @@ BoolConst truebool(TRUE);
 //
 //*********************************************************
 
-void program_class::cgen(ostream& os) {
+//
+// The assembly is collected in blocks of ASM_BUFFER_SIZE bytes, which are
+// written to the output only when full: the endl that ends every line
+// does not flush the output. In compact mode (-C) the lines that only hold
+// a comment are dropped as the blocks are written.
+//
+static const int ASM_BUFFER_SIZE = 1 << 16;
+
+class AsmBuffer : public std::streambuf {
+public:
+    AsmBuffer(ostream& out, bool compact)
+        : m_out(out), m_compact(compact), m_line_start(true), m_in_comment(false) {
+        m_block.resize(ASM_BUFFER_SIZE);
+        setp(&m_block[0], &m_block[0] + m_block.size());
+    }
+
+    ~AsmBuffer() {
+        WriteBlock();
+        m_out.flush();
+    }
+
+protected:
+    int_type overflow(int_type c) override {
+        WriteBlock();
+        if (c != traits_type::eof()) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+        std::streamsize left = n;
+        while (left > epptr() - pptr()) {
+            std::streamsize room = epptr() - pptr();
+            memcpy(pptr(), s, room);
+            pbump(room);
+            WriteBlock();
+            s += room;
+            left -= room;
+        }
+        memcpy(pptr(), s, left);
+        pbump(left);
+        return n;
+    }
+
+    int sync() override {
+        return 0;
+    }
+
+private:
+    void WriteBlock() {
+        if (!m_compact) {
+            m_out.write(pbase(), pptr() - pbase());
+        } else {
+            m_kept.clear();
+            for (char* c = pbase(); c != pptr(); ++c) {
+                Keep(*c);
+            }
+            m_out.write(m_kept.data(), m_kept.size());
+        }
+        setp(&m_block[0], &m_block[0] + m_block.size());
+    }
+
+    // Appends c to m_kept unless it is in a comment line. Blanks at the
+    // start of a line are held back until it is known not to be one.
+    void Keep(char c) {
+        if (m_in_comment) {
+            m_in_comment = c != '\n';
+            m_line_start = !m_in_comment;
+            return;
+        }
+        if (m_line_start && (c == ' ' || c == '\t')) {
+            m_indent += c;
+            return;
+        }
+        if (m_line_start && c == '#') {
+            m_in_comment = true;
+            m_indent.clear();
+            return;
+        }
+        if (m_line_start) {
+            m_line_start = false;
+            m_kept += m_indent;
+            m_indent.clear();
+        }
+        if (c == '\n') {
+            m_line_start = true;
+        }
+        m_kept += c;
+    }
+
+    ostream& m_out;
+    std::vector<char> m_block;
+    bool m_compact;
+    bool m_line_start;
+    bool m_in_comment;
+    std::string m_indent;
+    std::string m_kept;
+};
+
+void program_class::cgen(ostream& out) {
+    if (cgen_bytecode) {
+        BcProgram program;
+        initialize_constants();
+        codegen_classtable = new CgenClassTable(classes, out);
+        codegen_classtable->code_bytecode(program);
+        cgen_bytecode_status = RunBytecode(program, out, cgen_bytecode_counts);
+        return;
+    }
+
+    AsmBuffer buffer(out, cgen_compact);
+    ostream os(&buffer);
+
     // spim wants comments to start with '#'
     os << "# start of generated code\n";
 
     initialize_constants();
     codegen_classtable = new CgenClassTable(classes, os);
-    codegen_classtable->Execute();
+    if (cgen_x86) {
+        codegen_classtable->code_x86();
+    } else {
+        codegen_classtable->Execute();
+    }
 
     os << "\n# end of generated code\n";
 }
@@ -162,25 +395,54 @@ void program_class::cgen(ostream& os) {
 //
 //////////////////////////////////////////////////////////////////////////////
 
+static void NoteReg(const char* reg) {
+    if (std::strcmp(reg, RA) == 0) {
+        frame_use.calls = true;
+    } else if (std::strcmp(reg, SELF) == 0) {
+        frame_use.self = true;
+    } else if (std::strcmp(reg, FP) == 0) {
+        frame_use.fp = true;
+    }
+}
+
 static void emit_load(const char* dest_reg, int offset, const char* source_reg, ostream& s) {
+    NoteReg(dest_reg);
+    NoteReg(source_reg);
     s << LW << dest_reg << " " << offset* WORD_SIZE << "(" << source_reg << ")"
       << endl;
 }
 
 static void emit_store(const char* source_reg, int offset, const char* dest_reg, ostream& s) {
+    NoteReg(source_reg);
+    NoteReg(dest_reg);
     s << SW << source_reg << " " << offset* WORD_SIZE << "(" << dest_reg << ")"
       << endl;
 }
 
+static void emit_load_byte(const char* dest_reg, int offset, const char* source_reg, ostream& s) {
+    NoteReg(dest_reg);
+    NoteReg(source_reg);
+    s << LB << dest_reg << " " << offset << "(" << source_reg << ")" << endl;
+}
+
+static void emit_store_byte(const char* source_reg, int offset, const char* dest_reg, ostream& s) {
+    NoteReg(source_reg);
+    NoteReg(dest_reg);
+    s << SB << source_reg << " " << offset << "(" << dest_reg << ")" << endl;
+}
+
 static void emit_load_imm(const char* dest_reg, int val, ostream& s) {
+    NoteReg(dest_reg);
     s << LI << dest_reg << " " << val << endl;
 }
 
 static void emit_load_address(const char* dest_reg, const char* address, ostream& s) {
+    NoteReg(dest_reg);
     s << LA << dest_reg << " " << address << endl;
 }
 
 static void emit_partial_load_address(const char* dest_reg, ostream& s) {
+    NoteReg(dest_reg);
     s << LA << dest_reg << " ";
 }
 
@@ -203,55 +465,91 @@ static void emit_load_int(const char* dest, IntEntry* i, ostream& s) {
 }
 
 static void emit_move(const char* dest_reg, const char* source_reg, ostream& s) {
+    NoteReg(dest_reg);
+    NoteReg(source_reg);
     s << MOVE << dest_reg << " " << source_reg << endl;
 }
 
 static void emit_neg(const char* dest, const char* src1, ostream& s) {
+    NoteReg(dest);
+    NoteReg(src1);
     s << NEG << dest << " " << src1 << endl;
 }
 
 static void emit_add(const char* dest, const char* src1, const char* src2, ostream& s) {
+    NoteReg(dest);
+    NoteReg(src1);
+    NoteReg(src2);
     s << ADD << dest << " " << src1 << " " << src2 << endl;
 }
 
 static void emit_addu(const char* dest, const char* src1, const char* src2, ostream& s) {
+    NoteReg(dest);
+    NoteReg(src1);
+    NoteReg(src2);
     s << ADDU << dest << " " << src1 << " " << src2 << endl;
 }
 
 static void emit_addiu(const char* dest, const char* src1, int imm, ostream& s) {
+    NoteReg(dest);
+    NoteReg(src1);
     s << ADDIU << dest << " " << src1 << " " << imm << endl;
 }
 
 static void emit_div(const char* dest, const char* src1, const char* src2, ostream& s) {
+    NoteReg(dest);
+    NoteReg(src1);
+    NoteReg(src2);
     s << DIV << dest << " " << src1 << " " << src2 << endl;
 }
 
 static void emit_mul(const char* dest, const char* src1, const char* src2, ostream& s) {
+    NoteReg(dest);
+    NoteReg(src1);
+    NoteReg(src2);
     s << MUL << dest << " " << src1 << " " << src2 << endl;
 }
 
 static void emit_sub(const char* dest, const char* src1, const char* src2, ostream& s) {
+    NoteReg(dest);
+    NoteReg(src1);
+    NoteReg(src2);
     s << SUB << dest << " " << src1 << " " << src2 << endl;
 }
 
 static void emit_sll(const char* dest, const char* src1, int num, ostream& s) {
+    NoteReg(dest);
+    NoteReg(src1);
     s << SLL << dest << " " << src1 << " " << num << endl;
 }
 
 static void emit_jalr(const char* dest, ostream& s) {
+    NoteReg(dest);
+    frame_use.calls = true;
     s << JALR << "\t" << dest << endl;
 }
 
+static void emit_partial_jal(ostream& s) {
+    frame_use.calls = true;
+    s << JAL;
+}
+
 static void emit_jal(const char* address, ostream& s) {
-    s << JAL << address << endl;
+    emit_partial_jal(s);
+    s << address << endl;
 }
 
 static void emit_return(ostream& s) {
     s << RET << endl;
 }
 
+static void emit_syscall(int code, ostream& s) {
+    emit_load_imm(V0, code, s);
+    s << SYSCALL << endl;
+}
+
 static void emit_gc_assign(ostream& s) {
-    s << JAL << "_GenGC_Assign" << endl;
+    emit_jal("_GenGC_Assign", s);
 }
 
 static void emit_disptable_ref(Symbol sym, ostream& s) {
@@ -263,7 +561,7 @@ static void emit_init_ref(Symbol sym, ostream& s) {
 }
 
 static void emit_label_ref(int l, ostream& s) {
-    s << "label" << l;
+    s << label_scope << "_label" << l;
 }
 
 static void emit_protobj_ref(Symbol sym, ostream& s) {
@@ -274,53 +572,158 @@ static void emit_method_ref(Symbol classname, Symbol methodname, ostream& s) {
     s << classname << METHOD_SEP << methodname;
 }
 
+// True if the method is implemented in the runtime and needs an adapter
+// to be called with register arguments.
+static bool NeedsRegArgsAdapter(Symbol classname, Symbol methodname) {
+    CgenNode* _class_node = codegen_classtable->GetClassNode(classname);
+    if (!cgen_regargs || !_class_node->basic()) {
+        return false;
+    }
+    for (method_class* method : _class_node->GetMethods()) {
+        if (method->name == methodname) {
+            return method->GetArgNum() != 0;
+        }
+    }
+    return false;
+}
+
+// Unless -u is given the output of MIPS programs is buffered (see
+// code_buffered_io): the runtime's IO methods, and those that may end the
+// program, are replaced by versions that buffer or flush first, and
+// Main.main by one that flushes on return. The C runtime of -x buffers
+// its output itself.
+static bool IsOutputBuffered() {
+    return !cgen_unbuffered && !cgen_x86;
+}
+
+static bool IsBufferedIoMethod(Symbol classname, Symbol methodname) {
+    if (!IsOutputBuffered()) {
+        return false;
+    }
+    return (classname == IO && (methodname == out_string || methodname == out_int ||
+                                methodname == in_string || methodname == in_int)) ||
+           (classname == Object && methodname == cool_abort) ||
+           (classname == Str && methodname == substr);
+}
+
+void CgenNode::RenderLabels() {
+    m_protobj_label = std::string(name->get_string()) + PROTOBJ_SUFFIX;
+    m_init_label = std::string(name->get_string()) + CLASSINIT_SUFFIX;
+    for (method_class* method : GetMethods()) {
+        std::string label = std::string(name->get_string()) + METHOD_SEP + method->name->get_string();
+        if (IsBufferedIoMethod(name, method->name)) {
+            label += BUFFERED_SUFFIX;
+        } else if (IsOutputBuffered() && name == Main && method->name == main_meth) {
+            label += MAINBODY_SUFFIX;
+        }
+        m_method_labels[method->name] = label;
+        if (NeedsRegArgsAdapter(name, method->name)) {
+            label += REGARGS_SUFFIX;
+        }
+        m_callee_labels[method->name] = label;
+    }
+}
+
+// The entry point that callers, and dispatch tables, use for a method.
+static void emit_callee_ref(Symbol classname, Symbol methodname, ostream& s) {
+    s << codegen_classtable->GetClassNode(classname)->m_callee_labels.at(methodname);
+}
+
 static void emit_label_def(int l, ostream& s) {
     emit_label_ref(l, s);
     s << ":" << endl;
 }
 
 static void emit_beqz(char* source, int label, ostream& s) {
+    NoteReg(source);
     s << BEQZ << source << " ";
     emit_label_ref(label, s);
     s << endl;
 }
 
 static void emit_beq(const char* src1, const char* src2, int label, ostream& s) {
+    NoteReg(src1);
+    NoteReg(src2);
     s << BEQ << src1 << " " << src2 << " ";
     emit_label_ref(label, s);
     s << endl;
 }
 
 static void emit_bne(const char* src1, const char* src2, int label, ostream& s) {
+    NoteReg(src1);
+    NoteReg(src2);
     s << BNE << src1 << " " << src2 << " ";
     emit_label_ref(label, s);
     s << endl;
 }
 
 static void emit_bleq(const char* src1, const char* src2, int label, ostream& s) {
+    NoteReg(src1);
+    NoteReg(src2);
     s << BLEQ << src1 << " " << src2 << " ";
     emit_label_ref(label, s);
     s << endl;
 }
 
 static void emit_blt(const char* src1, const char* src2, int label, ostream& s) {
+    NoteReg(src1);
+    NoteReg(src2);
     s << BLT << src1 << " " << src2 << " ";
     emit_label_ref(label, s);
     s << endl;
 }
 
+static void emit_bge(const char* src1, const char* src2, int label, ostream& s) {
+    NoteReg(src1);
+    NoteReg(src2);
+    s << BGE << src1 << " " << src2 << " ";
+    emit_label_ref(label, s);
+    s << endl;
+}
+
+static void emit_bgt(const char* src1, const char* src2, int label, ostream& s) {
+    NoteReg(src1);
+    NoteReg(src2);
+    s << BGT << src1 << " " << src2 << " ";
+    emit_label_ref(label, s);
+    s << endl;
+}
+
 static void emit_blti(const char* src1, int imm, int label, ostream& s) {
+    NoteReg(src1);
     s << BLT << src1 << " " << imm << " ";
     emit_label_ref(label, s);
     s << endl;
 }
 
 static void emit_bgti(const char* src1, int imm, int label, ostream& s) {
+    NoteReg(src1);
     s << BGT << src1 << " " << imm << " ";
     emit_label_ref(label, s);
     s << endl;
 }
 
+static void emit_bgei(const char* src1, int imm, int label, ostream& s) {
+    NoteReg(src1);
+    s << BGE << src1 << " " << imm << " ";
+    emit_label_ref(label, s);
+    s << endl;
+}
+
+static void emit_bleqi(const char* src1, int imm, int label, ostream& s) {
+    NoteReg(src1);
+    s << BLEQ << src1 << " " << imm << " ";
+    emit_label_ref(label, s);
+    s << endl;
+}
+
+static void emit_beqi(const char* src1, int imm, int label, ostream& s) {
+    NoteReg(src1);
+    s << BEQ << src1 << " " << imm << " ";
+    emit_label_ref(label, s);
+    s << endl;
+}
+
 static void emit_branch(int l, ostream& s) {
     s << BRANCH;
     emit_label_ref(l, s);
@@ -330,11 +733,23 @@ static void emit_branch(int l, ostream& s) {
 //
 // Push a register on the stack. The stack grows towards smaller addresses.
 //
-static void emit_push(char* reg, ostream& str) {
+static void emit_push(const char* reg, ostream& str) {
     emit_store(reg, 0, SP, str);
     emit_addiu(SP, SP, -4, str);
 }
 
+//
+// Temporaries and let variables live in fixed slots of the method's frame,
+// below the saved registers: slot i is at -4 * (i + 1) off $fp.
+//
+static void emit_load_slot(const char* dest, int slot, ostream& s) {
+    emit_load(dest, -(slot + 1), FP, s);
+}
+
+static void emit_store_slot(const char* source, int slot, ostream& s) {
+    emit_store(source, -(slot + 1), FP, s);
+}
+
 //
 // Fetch the integer value in an Int object.
 // Emits code to fetch the integer value of the Integer object pointed
@@ -352,21 +767,129 @@ static void emit_store_int(char* source, const char* dest, ostream& s) {
     emit_store(source, DEFAULT_OBJFIELDS, dest, s);
 }
 
+// The value of an Int result is in T3. If it is in the pool, ACC becomes
+// the pooled Int; otherwise jumps to label.
+static void emit_pooled_int(int label, ostream& s) {
+    gen_state.int_pool_used = true;
+    s << "\t# Take the result from the pool if it is there." << endl;
+    emit_blti(T3, INT_POOL_MIN, label, s);
+    emit_bgti(T3, INT_POOL_MAX, label, s);
+    emit_addiu(T3, T3, -(INT_POOL_MIN), s);
+    emit_sll(T2, T3, 4, s);
+    emit_sll(T3, T3, 2, s);
+    emit_addu(T3, T3, T2, s);
+    emit_load_address(ACC, INTPOOL, s);
+    emit_addu(ACC, ACC, T3, s);
+}
+
 
 static void emit_test_collector(ostream& s) {
     emit_push(ACC, s);
     emit_move(ACC, SP, s); // stack end
     emit_move(A1, ZERO, s); // allocate nothing
-    s << JAL << gc_collect_names[cgen_Memmgr] << endl;
+    emit_jal(gc_collect_names[cgen_Memmgr], s);
     emit_addiu(SP, SP, 4, s);
     emit_load(ACC, 0, SP, s);
 }
 
+// Increments counter idx of the class being generated. The temporaries
+// are free wherever this is used.
+static void emit_profile_count(int idx, ostream& s) {
+    s << "\t# count" << endl;
+    s << LA << T1 << " " << label_scope << PROFTAB_SUFFIX << endl;
+    emit_load(T2, idx, T1, s);
+    emit_addiu(T2, T2, 1, s);
+    emit_store(T2, idx, T1, s);
+}
+
+// Dispatch sites are named by the class they are in, the method they call
+// and their line, in the counters of -P and in the profile of -F.
+static std::string GetDispatchSiteName(CgenNode* class_node, Symbol method_name, int line) {
+    std::ostringstream name;
+    name << class_node->name << " " << method_name << " " << line;
+    return name.str();
+}
+
+// Reads the profile of -F. Each line holds a dispatch site, then the
+// receiver classes seen there, each followed by its number of calls.
+// Classes that the program no longer has are ignored.
+static void LoadReceiverProfile(const char* filename) {
+    std::ifstream in(filename);
+    if (!in) {
+        cerr << "Cannot open profile file " << filename << endl;
+        exit(1);
+    }
+    std::map<std::string, CgenNode*> class_nodes;
+    for (CgenNode* class_node : codegen_classtable->GetClassNodes()) {
+        class_nodes[class_node->name->get_string()] = class_node;
+    }
+
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string class_name, method_name, receiver;
+        int line_number, count;
+        if (!(fields >> class_name >> method_name >> line_number)) {
+            continue;
+        }
+        std::ostringstream site;
+        site << class_name << " " << method_name << " " << line_number;
+        auto& receivers = receiver_profile[site.str()];
+        while (fields >> receiver >> count) {
+            if (class_nodes.count(receiver) != 0) {
+                receivers.push_back(std::make_pair(count, class_nodes[receiver]));
+            }
+        }
+        std::sort(receivers.begin(), receivers.end(),
+                  [](const std::pair<int, CgenNode*>& a, const std::pair<int, CgenNode*>& b) {
+                      return a.first > b.first;
+                  });
+    }
+}
+
+// The receiver classes to speculate on at the dispatch site named site,
+// whose receivers are instances of class_node.
+static std::vector<CgenNode*> GetHotReceivers(const std::string& site, CgenNode* class_node) {
+    std::vector<CgenNode*> ret;
+    auto iter = receiver_profile.find(site);
+    if (iter == receiver_profile.end()) {
+        return ret;
+    }
+    long long total = 0;
+    for (auto& receiver : iter->second) {
+        total += receiver.first;
+    }
+    for (auto& receiver : iter->second) {
+        if (ret.size() < SPECULATION_MAX && receiver.first * 3LL >= total && receiver.first > 0 &&
+            receiver.second->IsSubclassOf(class_node)) {
+            ret.push_back(receiver.second);
+        }
+    }
+    return ret;
+}
+
+// Counts the class of the receiver in ACC at the dispatch site named
+// site, whose receivers are instances of class_node.
+static void emit_receiver_count(CgenNode* class_node, const std::string& site, ostream& s) {
+    int first = profile_method_num + gen_state.profile_sites.size();
+    for (int tag = class_node->class_tag; tag <= class_node->class_tag_end; ++tag) {
+        gen_state.profile_sites.push_back(ProfileSite { site, PROFILE_RECEIVER, tag });
+    }
+    s << "\t# count the class of the receiver" << endl;
+    s << LA << T1 << " " << label_scope << PROFTAB_SUFFIX << endl;
+    emit_load(T2, 0, ACC, s);
+    emit_sll(T2, T2, LOG_WORD_SIZE, s);
+    emit_addu(T1, T1, T2, s);
+    emit_load(T2, first - class_node->class_tag, T1, s);
+    emit_addiu(T2, T2, 1, s);
+    emit_store(T2, first - class_node->class_tag, T1, s);
+}
+
 static void emit_gc_check(char* source, ostream& s) {
     if (std::string(source) != std::string(A1)) {
         emit_move(A1, source, s);
     }
-    s << JAL << "_gc_check" << endl;
+    emit_jal("_gc_check", s);
 }
 
 
@@ -395,6 +918,7 @@ static void emit_gc_check(char* source, ostream& s) {
 // Strings
 //
 void StringEntry::code_ref(ostream& s) {
+    gen_state.used_str_consts.insert(this);
     s << STRCONST_PREFIX << index;
 }
 
@@ -430,11 +954,13 @@ void StringEntry::code_def(ostream& s, int stringclasstag) {
 //
 // StrTable::code_string
 // Generate a string object definition for every string constant in the
-// stringtable.
+// stringtable that has been referenced.
 //
 void StrTable::code_string_table(ostream& s, int stringclasstag) {
     for (List<StringEntry> *l = tbl; l; l = l->tl()) {
-        l->hd()->code_def(s, stringclasstag);
+        if (gen_state.used_str_consts.count(l->hd()) != 0) {
+            l->hd()->code_def(s, stringclasstag);
+        }
     }
 }
 
@@ -442,6 +968,7 @@ void StrTable::code_string_table(ostream& s, int stringclasstag) {
 // Ints
 //
 void IntEntry::code_ref(ostream& s) {
+    gen_state.used_int_consts.insert(this);
     s << INTCONST_PREFIX << index;
 }
 
@@ -471,11 +998,14 @@ void IntEntry::code_def(ostream& s, int intclasstag) {
 //
 // IntTable::code_string_table
 // Generate an Int object definition for every Int constant in the
-// inttable.
+// inttable that has been referenced, including the lengths of the strings
+// emitted.
 //
 void IntTable::code_string_table(ostream& s, int intclasstag) {
     for (List<IntEntry> *l = tbl; l; l = l->tl()) {
-        l->hd()->code_def(s, intclasstag);
+        if (gen_state.used_int_consts.count(l->hd()) != 0) {
+            l->hd()->code_def(s, intclasstag);
+        }
     }
 }
 
@@ -572,6 +1102,14 @@ void CgenClassTable::code_global_data() {
         << WORD << boolclasstag << endl;
     str << STRINGTAG << LABEL
         << WORD << stringclasstag << endl;
+
+    if (IsOutputBuffered()) {
+        // The output buffer (see code_buffered_io), with room for a NUL.
+        str << OUTLEN << LABEL
+            << WORD << 0 << endl;
+        str << OUTBUF << LABEL
+            << "\t.space\t" << OUTBUF_SIZE + WORD_SIZE << endl;
+    }
 }
 
 
@@ -635,17 +1173,28 @@ void CgenClassTable::code_select_gc() {
 //********************************************************
 
 void CgenClassTable::code_constants() {
-    //
-    // Add constants that are required by the code generator.
-    //
-    stringtable.add_string("");
-    inttable.add_string("0");
-
     stringtable.code_string_table(str, stringclasstag);
     inttable.code_string_table(str, intclasstag);
+    if (gen_state.int_pool_used) {
+        code_int_pool();
+    }
     code_bools(boolclasstag);
 }
 
+// Each pooled Int takes 5 words with its eyecatcher.
+void CgenClassTable::code_int_pool() {
+    for (int i = INT_POOL_MIN; i <= INT_POOL_MAX; ++i) {
+        str << WORD << "-1" << endl;
+        if (i == INT_POOL_MIN) {
+            str << INTPOOL << LABEL;
+        }
+        str << WORD << intclasstag << endl;
+        str << WORD << (DEFAULT_OBJFIELDS + INT_SLOTS) << endl;
+        str << WORD << Int << DISPTAB_SUFFIX << endl;
+        str << WORD << i << endl;
+    }
+}
+
 void CgenClassTable::code_class_nameTab() {
     str << CLASSNAMETAB << LABEL;
 
@@ -670,24 +1219,20 @@ void CgenClassTable::code_class_objTab() {
     // Find all class names.
     std::vector<CgenNode*> class_nodes = GetClassNodes();
     for (CgenNode* class_node : class_nodes) {
-        Symbol class_name = class_node->name;
-        StringEntry* str_entry = stringtable.lookup_string(class_name->get_string());
-
-        str << WORD;
-        emit_protobj_ref(str_entry, str);
-        str << endl;
-        str << WORD;
-        emit_init_ref(str_entry, str);
-        str << endl;
+        str << WORD << class_node->m_protobj_label << endl;
+        str << WORD << class_node->m_init_label << endl;
     }
 }
 
+// Classes whose dispatch tables are identical, e.g. a subclass that
+// overrides and adds no methods, share one table with all their labels.
 void CgenClassTable::code_dispatchTabs() {
     std::vector<CgenNode*> class_nodes = GetClassNodes();
 
+    std::vector<std::string> tables;
+    std::map<std::string, std::vector<CgenNode*>> classes_by_table;
     for (CgenNode* _class_node : class_nodes) {
-        emit_disptable_ref(_class_node->name, str);
-        str << LABEL;
+        std::ostringstream table;
         std::vector<method_class*> full_methods = _class_node->GetFullMethods();
         std::map<Symbol, Symbol> dispatch_class_tab = _class_node->GetDispatchClassTab();
         std::map<Symbol, int> dispatch_idx_tab = _class_node->GetDispatchIdxTab();
@@ -695,30 +1240,52 @@ void CgenClassTable::code_dispatchTabs() {
             Symbol _method_name = _method->name;
             Symbol _class_name = dispatch_class_tab[_method_name];
             int _idx = dispatch_idx_tab[_method_name];
-            str << "\t# method # " << _idx << endl;
-            str << WORD;
-            emit_method_ref(_class_name, _method_name, str);
-            str << endl;
+            table << "\t# method # " << _idx << endl;
+            table << WORD;
+            emit_callee_ref(_class_name, _method_name, table);
+            table << endl;
+        }
+        tables.push_back(table.str());
+        classes_by_table[table.str()].push_back(_class_node);
+    }
+
+    for (size_t i = 0; i < class_nodes.size(); ++i) {
+        std::vector<CgenNode*>& sharing = classes_by_table[tables[i]];
+        if (sharing.front() != class_nodes[i]) {
+            continue;
         }
+        for (CgenNode* _class_node : sharing) {
+            emit_disptable_ref(_class_node->name, str);
+            str << LABEL;
+        }
+        str << tables[i];
     }
 }
 
+// Class tags are assigned in DFS preorder of the inheritance tree, so that
+// the tags of any subtree form a contiguous range. m_class_nodes is indexed
+// by tag.
 std::vector<CgenNode*> CgenClassTable::GetClassNodes() {
     if (m_class_nodes.empty()) {
-        for (List<CgenNode> *l = nds; l; l = l->tl()) {
-            CgenNode* class_node = l->hd();
-            m_class_nodes.push_back(class_node);
-        }
-        std::reverse(m_class_nodes.begin(), m_class_nodes.end());
-        for (int i = 0; i < m_class_nodes.size(); ++i) {
-            m_class_nodes[i]->class_tag = i;
-            m_class_tags.insert(std::make_pair(m_class_nodes[i]->get_name(), i));
-        }
+        AssignClassTags(root());
     }
 
     return m_class_nodes;
 }
 
+void CgenClassTable::AssignClassTags(CgenNode* class_node) {
+    class_node->class_tag = m_class_nodes.size();
+    m_class_nodes.push_back(class_node);
+    m_class_tags.insert(std::make_pair(class_node->get_name(), class_node->class_tag));
+
+    // Children are kept in declaration order.
+    std::vector<CgenNode*> children = class_node->GetChildren();
+    for (CgenNode* child : children) {
+        AssignClassTags(child);
+    }
+    class_node->class_tag_end = m_class_nodes.size() - 1;
+}
+
 std::map<Symbol, int> CgenClassTable::GetClassTags() {
     GetClassNodes();
     return m_class_tags;
@@ -823,47 +1390,156 @@ std::map<Symbol, int> CgenNode::GetDispatchIdxTab() {
     return m_dispatch_idx_tab;
 }
 
-void method_class::code(ostream& s, CgenNode* class_node) {
-    emit_method_ref(class_node->name, name, s);
-    s << LABEL;
-    s << "\t# push fp, s0, ra" << endl;
-    emit_addiu(SP, SP, -12, s);
-    emit_store(FP, 3, SP, s);
-    emit_store(SELF, 2, SP, s);
-    emit_store(RA, 1, SP, s);
+//
+// Frame layout, from high to low addresses: the actuals pushed by the
+// caller, saved $fp, saved $s0, saved $ra, then the slots for let
+// variables and temporaries. $fp points at the saved $ra, so actual i is
+// at 4 * (i + 3) and slot i at -4 * (i + 1). With register arguments
+// only the actuals after the first REG_ARG_NUM are pushed.
+//
+// The body is generated before the prologue so that the whole frame can
+// be allocated at once. A leaf, which makes no calls (and no tail calls,
+// which restore $ra), only saves the registers its body uses and never
+// saves $ra.
+//
+static void emit_frame(const std::string& body, const FrameUse& use, int slots, int arg_num,
+                       ostream& s) {
+    bool has_call = use.calls;
+    bool uses_self = has_call || use.self;
+    bool uses_fp = has_call || use.fp;
+    int frame_size = 0;
+    if (uses_self || uses_fp) {
+        frame_size = 12 + 4 * slots;
+    }
+
+    if (frame_size != 0) {
+        s << "\t# allocate frame: " << slots << " slots" << (has_call ? "" : ", leaf") << endl;
+        emit_addiu(SP, SP, -frame_size, s);
+    }
+    if (uses_fp) {
+        emit_store(FP, frame_size / 4, SP, s);
+    }
+    if (uses_self) {
+        emit_store(SELF, frame_size / 4 - 1, SP, s);
+    }
+    if (has_call) {
+        emit_store(RA, frame_size / 4 - 2, SP, s);
+    }
+    if (uses_fp) {
+        s << "\t# fp now points to the return addr in stack" << endl;
+        emit_addiu(FP, SP, frame_size - 8, s);
+    }
+    if (uses_self) {
+        s << "\t# SELF = a0" << endl;
+        emit_move(SELF, ACC, s);
+    }
+    if (has_call && cgen_Memmgr == GC_GENGC) {
+        // The collector scans the stack, so slots must not hold stale
+        // pointers left by earlier frames.
+        for (int i = 0; i < slots; ++i) {
+            emit_store_slot(ZERO, i, s);
+        }
+    }
     s << endl;
-    
-    s << "\t# fp now points to the return addr in stack" << endl;
-    emit_addiu(FP, SP, 4, s);
+
+    s << body;
     s << endl;
 
-    s << "\t# SELF = a0" << endl;
-    emit_move(SELF, ACC, s);
+    s << "\t# restore registers, pop frame and arguments" << endl;
+    if (has_call) {
+        emit_load(RA, frame_size / 4 - 2, SP, s);
+    }
+    if (uses_self) {
+        emit_load(SELF, frame_size / 4 - 1, SP, s);
+    }
+    if (uses_fp) {
+        emit_load(FP, frame_size / 4, SP, s);
+    }
+    if (frame_size + arg_num * 4 != 0) {
+        emit_addiu(SP, SP, frame_size + arg_num * 4, s);
+    }
+    s << endl;
+
+    s << "\t# return" << endl;
+    emit_return(s);
     s << endl;
+}
 
-    s << "\t# evaluating expression and put it to ACC" << endl;
+// Generates the body of method, without the prologue and epilogue, and
+// counts the slots it needs and notes what else it needs of its frame.
+static std::string GenerateMethodBody(method_class* method, CgenNode* class_node,
+                                      bool params_in_regs, int& slots, FrameUse& use) {
+    frame_use = FrameUse();
+    std::ostringstream code;
+    if (cgen_profile) {
+        // After the label that self-recursive tail calls loop back to, so
+        // that they are counted too.
+        std::vector<method_class*> methods = class_node->GetMethods();
+        emit_profile_count(std::find(methods.begin(), methods.end(), method) - methods.begin(), code);
+    }
+    code << "\t# evaluating expression and put it to ACC" << endl;
+    slots = 0;
     Environment env;
     env.m_class_node = class_node;
+    env.m_max_slots = &slots;
+    env.m_tail_expr = method->expr;
+    std::set<int> non_void;
+    env.m_non_void = &non_void;
+    Formals formals = method->formals;
     for (int i = formals->first(); formals->more(i); i = formals->next(i)) {
         env.AddParam(formals->nth(i)->GetName());
     }
-    expr->code(s, env);
-    s << endl;
+    env.m_reg_param_num = GetRegArgNum(method->GetArgNum());
+    env.m_params_in_regs = params_in_regs;
 
-    s << "\t# pop fp, s0, ra" << endl;
-    emit_load(FP, 3, SP, s);
-    emit_load(SELF, 2, SP, s);
-    emit_load(RA, 1, SP, s);
-    emit_addiu(SP, SP, 12, s);
-    s << endl;
+    std::ostringstream spill;
+    if (!params_in_regs && env.m_reg_param_num != 0) {
+        spill << "\t# store the register args" << endl;
+        env.EnterScope();
+        for (int i = 0; i < env.m_reg_param_num; ++i) {
+            int slot = env.AddVar(formals->nth(formals->first() + i)->GetName());
+            emit_store_slot(ARG_REGS[i], slot, spill);
+        }
+        spill << endl;
+    }
 
-    s << "\t# Pop arguments" << endl;
-    emit_addiu(SP, SP, GetArgNum() * 4, s);
-    s << endl;
+    body_label = -1;
+    inline_stack.push_back(method);
+    method->expr->code(code, env);
+    inline_stack.pop_back();
 
-    s << "\t# return" << endl;
-    emit_return(s);
-    s << endl;
+    std::ostringstream body;
+    body << spill.str();
+    if (body_label != -1) {
+        body << "\t# body, where self-recursive tail calls loop back to" << endl;
+        emit_label_def(body_label, body);
+    }
+    body << code.str();
+    use = frame_use;
+    return body.str();
+}
+
+void method_class::code(ostream& s, CgenNode* class_node) {
+    s << class_node->m_method_labels.at(name) << LABEL;
+
+    int slots = 0;
+    FrameUse use;
+    std::string body;
+    if (GetRegArgNum(GetArgNum()) == 0) {
+        body = GenerateMethodBody(this, class_node, false, slots, use);
+    } else {
+        // A leaf can keep its register args where they are. Whether it is
+        // one is only known once it has been generated, so generate it
+        // again, from the same state, if it is not.
+        GenState state = gen_state;
+        body = GenerateMethodBody(this, class_node, true, slots, use);
+        if (use.calls) {
+            gen_state = state;
+            body = GenerateMethodBody(this, class_node, false, slots, use);
+        }
+    }
+
+    emit_frame(body, use, slots, GetStackArgNum(GetArgNum()), s);
 }
 
 void CgenNode::code_protObj(ostream& s) {
@@ -912,79 +1588,130 @@ void CgenNode::code_protObj(ostream& s) {
     }
 }
 
+// With GenGC every store of a pointer that may be young into a heap object
+// must be recorded by _GenGC_Assign. ACC has just been stored to the
+// attribute at word offset of SELF, a class_node; needed is false when the
+// analysis has shown the store cannot create an old-to-young pointer. An
+// object in a frame (see AnalyzeEscapes) is above the heap and the stack
+// is scanned anyway, so its stores are not recorded.
+static void emit_write_barrier(int offset, bool needed, CgenNode* class_node, ostream& s) {
+    if (cgen_Memmgr != GC_GENGC) {
+        return;
+    }
+    if (!needed) {
+        s << "\t# write barrier elided" << endl;
+        ++gen_state.write_barriers_elided;
+        return;
+    }
+    int labelnum_skip = -1;
+    if (stack_object_classes.count(class_node) != 0) {
+        labelnum_skip = gen_state.labelnum++;
+        emit_bge(SELF, SP, labelnum_skip, s);
+    }
+    emit_addiu(A1, SELF, 4 * offset, s);
+    emit_gc_assign(s);
+    if (labelnum_skip != -1) {
+        emit_label_def(labelnum_skip, s);
+    }
+    ++gen_state.write_barriers_emitted;
+}
+
+// True if running the initializer of class_node (including those of its
+// ancestors) may start a collection.
+static bool InitMayAllocate(CgenNode* class_node) {
+    if (class_node->basic()) {
+        return false;
+    }
+    if (InitMayAllocate(class_node->get_parentnd())) {
+        return true;
+    }
+    for (attr_class* attrib : class_node->GetAttribs()) {
+        if (attrib->init->MayAllocate()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// True if class_node declares an attribute with an initializer.
+static bool InitsOwnAttribs(CgenNode* class_node) {
+    for (attr_class* attrib : class_node->GetAttribs()) {
+        if (!attrib->init->IsEmpty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// True if the initializer of class_node (including those of its ancestors)
+// does nothing: every attribute keeps the default value that code_protObj
+// has already put in the protObj, so new need not call it.
+bool IsTrivialInit(CgenNode* class_node) {
+    if (class_node->basic()) {
+        return true;
+    }
+    return IsTrivialInit(class_node->get_parentnd()) && !InitsOwnAttribs(class_node);
+}
+
 void CgenNode::code_init(ostream& s) {
     s << get_name();
     s << CLASSINIT_SUFFIX;
     s << LABEL;
-    s << "\t# push fp, s0, ra" << endl;
-    emit_addiu(SP, SP, -12, s);
-    emit_store(FP, 3, SP, s);
-    emit_store(SELF, 2, SP, s);
-    emit_store(RA, 1, SP, s);
-    s << endl;
-    
-    s << "\t# fp now points to the return addr in stack" << endl;
-    emit_addiu(FP, SP, 4, s);
-    s << endl;
 
-    s << "\t# SELF = a0" << endl;
-    emit_move(SELF, ACC, s);
-    s << endl;
-    
+    if (IsTrivialInit(this)) {
+        // Still referenced by class_objTab and the runtime. ACC is self.
+        emit_return(s);
+        s << endl;
+        return;
+    }
+
+    std::ostringstream body;
+    int slots = 0;
+    frame_use = FrameUse();
+
     Symbol parent_name = get_parentnd()->name;
-    if (parent_name != No_class) {
-        s << "\t# init parent" << endl;
-        s << JAL;
-        emit_init_ref(parent_name, s);
-        s << endl << endl;
+    if (parent_name != No_class && !IsTrivialInit(get_parentnd())) {
+        body << "\t# init parent" << endl;
+        emit_partial_jal(body);
+        emit_init_ref(parent_name, body);
+        body << endl << endl;
     }
 
+    // _init only runs on an object that new has just allocated, so self
+    // stays in the young generation, and needs no write barriers, until
+    // something allocates and a collection may promote it.
+    bool self_is_young = !InitMayAllocate(get_parentnd());
+
     std::vector<attr_class*> attribs = GetAttribs();
     std::map<Symbol, int> attrib_idx_tab = GetAttribIdxTab();
     for (attr_class* attrib : attribs) {
-        s << "\t# init attrib " << attrib->name << endl;
+        body << "\t# init attrib " << attrib->name << endl;
         int idx = attrib_idx_tab[attrib->name];
 
         if (attrib->init->IsEmpty()) {
-            // We still need to deal with basic types.
-            if (attrib->type_decl == Str) {
-                emit_load_string(ACC, stringtable.lookup_string(""), s);
-                emit_store(ACC, 3 + idx, SELF, s);
-            } else if (attrib->type_decl == Int) {
-                emit_load_int(ACC, inttable.lookup_string("0"), s);
-                emit_store(ACC, 3 + idx, SELF, s);
-            } else if (attrib->type_decl == Bool) {
-                emit_load_bool(ACC, BoolConst(0), s);
-                emit_store(ACC, 3 + idx, SELF, s);
-            }
+            // The protObj already holds the default value.
+            body << "\t# default value from protObj" << endl;
         } else {
             Environment env;
             env.m_class_node = this;
-            attrib->init->code(s, env);
-            
-            emit_store(ACC, 3 + idx, SELF, s);
-            if (cgen_Memmgr == 1) {
-                emit_addiu(A1, SELF, 4 * (idx + 3), s);
-                emit_jal("_GenGC_Assign", s);
+            env.m_max_slots = &slots;
+            std::set<int> non_void;
+            env.m_non_void = &non_void;
+            attrib->init->code(body, env);
+            if (attrib->init->MayAllocate()) {
+                self_is_young = false;
             }
-            s << endl;
+
+            emit_store(ACC, 3 + idx, SELF, body);
+            emit_write_barrier(3 + idx, !self_is_young && !attrib->init->IsStaticValue(), this, body);
+            body << endl;
         }
     }
 
-    s << "\t# ret = SELF" << endl;
-    emit_move(ACC, SELF, s);
-    s << endl;
-
-    s << "\t# pop fp, s0, ra" << endl;
-    emit_load(FP, 3, SP, s);
-    emit_load(SELF, 2, SP, s);
-    emit_load(RA, 1, SP, s);
-    emit_addiu(SP, SP, 12, s);
-    s << endl;
+    body << "\t# ret = SELF" << endl;
+    emit_move(ACC, SELF, body);
 
-    s << "\t# return" << endl;
-    emit_return(s);
-    s << endl;
+    emit_frame(body.str(), frame_use, slots, 0, s);
 }
 
 void CgenNode::code_methods(ostream& s) {
@@ -1001,23 +1728,359 @@ void CgenClassTable::code_protObjs() {
     }
 }
 
-void CgenClassTable::code_class_inits() {
-    std::vector<CgenNode*> class_nodes = GetClassNodes();
-    for (CgenNode* class_node : class_nodes) {
-        class_node->code_init(str);
+// The init and methods of one class, and what generating them left for
+// the rest of the program.
+struct ClassText {
+    std::string init;
+    std::string methods;
+    GenState state;
+};
+
+static void GenerateClassText(CgenNode* class_node, ClassText& text) {
+    gen_state = GenState();
+    label_scope = class_node->name->get_string();
+    profile_method_num = class_node->basic() ? 0 : class_node->GetMethods().size();
+
+    std::ostringstream init;
+    class_node->code_init(init);
+    text.init = init.str();
+    if (!class_node->basic()) {
+        std::ostringstream methods;
+        class_node->code_methods(methods);
+        text.methods = methods.str();
     }
+
+    text.state = gen_state;
 }
 
-void CgenClassTable::code_class_methods() {
+// Classes are generated in parallel, each into its own buffer, and then
+// written in tag order: all the inits, then all the methods.
+void CgenClassTable::code_class_text() {
     std::vector<CgenNode*> class_nodes = GetClassNodes();
+
+    // The tables of the class nodes are built on first use; build them all
+    // now, so that the threads only read them.
     for (CgenNode* class_node : class_nodes) {
-        if (!class_node->basic()) {
-            class_node->code_methods(str);
+        class_node->GetMethods();
+        class_node->GetFullMethods();
+        class_node->GetAttribs();
+        class_node->GetFullAttribs();
+    }
+
+    int class_num = class_nodes.size();
+    std::vector<ClassText> texts(class_num);
+    std::atomic<int> next_class(0);
+    auto generate = [&]() {
+        for (int i = next_class++; i < class_num; i = next_class++) {
+            GenerateClassText(class_nodes[i], texts[i]);
         }
+    };
+    // Not on this thread, whose state holds what the tables referenced.
+    int thread_num = std::max<int>(1, std::min<int>(std::thread::hardware_concurrency(), class_num));
+    std::vector<std::thread> threads;
+    for (int i = 0; i < thread_num; ++i) {
+        threads.emplace_back(generate);
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
     }
-}
 
-CgenClassTable::CgenClassTable(Classes classes, ostream& s) : nds(NULL) , str(s) {
+    for (const ClassText& text : texts) {
+        str << text.init;
+    }
+    for (const ClassText& text : texts) {
+        str << text.methods;
+    }
+
+    gen_state.abort_stubs.clear();
+    for (int i = 0; i < class_num; ++i) {
+        class_nodes[i]->m_profile_sites = texts[i].state.profile_sites;
+    }
+    for (const ClassText& text : texts) {
+        const GenState& state = text.state;
+        gen_state.abort_stubs.insert(gen_state.abort_stubs.end(), state.abort_stubs.begin(),
+                                     state.abort_stubs.end());
+        gen_state.used_str_consts.insert(state.used_str_consts.begin(),
+                                        state.used_str_consts.end());
+        gen_state.used_int_consts.insert(state.used_int_consts.begin(),
+                                        state.used_int_consts.end());
+        gen_state.int_pool_used = gen_state.int_pool_used || state.int_pool_used;
+        gen_state.write_barriers_emitted += state.write_barriers_emitted;
+        gen_state.write_barriers_elided += state.write_barriers_elided;
+    }
+}
+
+// The runtime's methods take all their arguments on the stack, and pop
+// them, so their adapters push the register arguments and jump to them.
+void CgenClassTable::code_regargs_adapters() {
+    for (CgenNode* class_node : GetClassNodes()) {
+        for (method_class* method : class_node->GetMethods()) {
+            if (!NeedsRegArgsAdapter(class_node->name, method->name)) {
+                continue;
+            }
+            emit_callee_ref(class_node->name, method->name, str);
+            str << LABEL;
+            for (int i = 0; i < GetRegArgNum(method->GetArgNum()); ++i) {
+                emit_push(ARG_REGS[i], str);
+            }
+            str << JUMP << class_node->m_method_labels.at(method->name) << endl << endl;
+        }
+    }
+}
+
+// Buffered output (unless -u). The runtime prints every out_string and
+// out_int with a syscall of its own; these versions append to OUTBUF
+// instead, and OUTFLUSH prints it when it is full, before input is read,
+// when Main.main returns and before the runtime ends the program. They
+// take their arguments like the runtime's methods, and may likewise
+// clobber the temporaries; OUTFLUSH itself only clobbers $v0, $t1 and $t2.
+// Input is still read by the runtime: its read_string and read_int
+// syscalls take a whole line each, and in_string and in_int read one
+// line per call, so a buffer would not save syscalls.
+void CgenClassTable::code_buffered_io() {
+    label_scope = "_io";
+    int labelnum_done = gen_state.labelnum++;
+    str << OUTFLUSH << LABEL;
+    emit_load_address(T1, OUTLEN, str);
+    emit_load(T2, 0, T1, str);
+    emit_beqz(T2, labelnum_done, str);
+    emit_store(ZERO, 0, T1, str);
+    emit_load_address(T1, OUTBUF, str);
+    emit_addu(T2, T1, T2, str);
+    emit_store_byte(ZERO, 0, T2, str);
+    emit_move(T2, ACC, str);
+    emit_move(ACC, T1, str);
+    emit_syscall(4, str);
+    emit_move(ACC, T2, str);
+    emit_label_def(labelnum_done, str);
+    emit_return(str);
+    str << endl;
+
+    // out_string: copy the chars to the buffer, flushing it first if they
+    // do not fit; a string longer than the buffer is printed on its own.
+    // Strings end with a NUL, so they can be printed where they are.
+    CgenNode* _io = GetClassNode(IO);
+    int labelnum_copy = gen_state.labelnum++;
+    int labelnum_loop = gen_state.labelnum++;
+    labelnum_done = gen_state.labelnum++;
+    str << _io->m_method_labels.at(out_string) << LABEL;
+    emit_load(T3, 1, SP, str);
+    emit_addiu(SP, SP, 4, str);
+    emit_load(T4, 3, T3, str);
+    emit_load(T4, 3, T4, str);
+    emit_addiu(T3, T3, 4 * (DEFAULT_OBJFIELDS + STRING_SLOTS), str);
+    emit_load_address(T5, OUTLEN, str);
+    emit_load(A2, 0, T5, str);
+    emit_addu(A3, A2, T4, str);
+    emit_bleqi(A3, OUTBUF_SIZE, labelnum_copy, str);
+    emit_move(A3, RA, str);
+    emit_jal(OUTFLUSH, str);
+    emit_move(RA, A3, str);
+    emit_load_imm(A2, 0, str);
+    emit_bleqi(T4, OUTBUF_SIZE, labelnum_copy, str);
+    emit_move(T2, ACC, str);
+    emit_move(ACC, T3, str);
+    emit_syscall(4, str);
+    emit_move(ACC, T2, str);
+    emit_return(str);
+    emit_label_def(labelnum_copy, str);
+    emit_load_address(T1, OUTBUF, str);
+    emit_addu(T1, T1, A2, str);
+    emit_addu(A2, A2, T4, str);
+    emit_store(A2, 0, T5, str);
+    emit_addu(T4, T3, T4, str);
+    emit_beq(T3, T4, labelnum_done, str);
+    emit_label_def(labelnum_loop, str);
+    emit_load_byte(T2, 0, T3, str);
+    emit_store_byte(T2, 0, T1, str);
+    emit_addiu(T3, T3, 1, str);
+    emit_addiu(T1, T1, 1, str);
+    emit_bne(T3, T4, labelnum_loop, str);
+    emit_label_def(labelnum_done, str);
+    emit_return(str);
+    str << endl;
+
+    // out_int: make room for the longest Int, "-2147483648", then write
+    // the digits backwards from the end of the number. The value is
+    // negated when positive, as the most negative Int cannot be.
+    int labelnum_fits = gen_state.labelnum++;
+    int labelnum_negative = gen_state.labelnum++;
+    int labelnum_digits = gen_state.labelnum++;
+    int labelnum_count = gen_state.labelnum++;
+    int labelnum_write = gen_state.labelnum++;
+    str << _io->m_method_labels.at(out_int) << LABEL;
+    emit_load(T3, 1, SP, str);
+    emit_addiu(SP, SP, 4, str);
+    emit_load(T3, 3, T3, str);
+    emit_load_address(T5, OUTLEN, str);
+    emit_load(A2, 0, T5, str);
+    emit_bleqi(A2, OUTBUF_SIZE - 11, labelnum_fits, str);
+    emit_move(A3, RA, str);
+    emit_jal(OUTFLUSH, str);
+    emit_move(RA, A3, str);
+    emit_load_imm(A2, 0, str);
+    emit_label_def(labelnum_fits, str);
+    emit_load_address(T1, OUTBUF, str);
+    emit_addu(T1, T1, A2, str);
+    emit_blt(T3, ZERO, labelnum_negative, str);
+    emit_neg(T3, T3, str);
+    emit_branch(labelnum_digits, str);
+    emit_label_def(labelnum_negative, str);
+    emit_load_imm(T2, '-', str);
+    emit_store_byte(T2, 0, T1, str);
+    emit_addiu(T1, T1, 1, str);
+    emit_label_def(labelnum_digits, str);
+    emit_load_imm(T4, 10, str);
+    emit_move(T2, T3, str);
+    emit_label_def(labelnum_count, str);
+    emit_addiu(T1, T1, 1, str);
+    emit_div(T2, T2, T4, str);
+    emit_bne(T2, ZERO, labelnum_count, str);
+    emit_load_address(T2, OUTBUF, str);
+    emit_sub(T2, T1, T2, str);
+    emit_store(T2, 0, T5, str);
+    emit_label_def(labelnum_write, str);
+    emit_div(T2, T3, T4, str);
+    emit_mul(A3, T2, T4, str);
+    emit_sub(A3, A3, T3, str);
+    emit_addiu(A3, A3, '0', str);
+    emit_addiu(T1, T1, -1, str);
+    emit_store_byte(A3, 0, T1, str);
+    emit_move(T3, T2, str);
+    emit_bne(T3, ZERO, labelnum_write, str);
+    emit_return(str);
+    str << endl;
+
+    // in_int flushes and calls the runtime's, whose result is replaced by
+    // the pooled Int if it is in the pool.
+    labelnum_done = gen_state.labelnum++;
+    str << _io->m_method_labels.at(in_int) << LABEL;
+    emit_push(RA, str);
+    emit_jal(OUTFLUSH, str);
+    emit_partial_jal(str);
+    emit_method_ref(IO, in_int, str);
+    str << endl;
+    emit_load(T3, 3, ACC, str);
+    emit_pooled_int(labelnum_done, str);
+    emit_label_def(labelnum_done, str);
+    emit_load(RA, 1, SP, str);
+    emit_addiu(SP, SP, 4, str);
+    emit_return(str);
+    str << endl;
+
+    // The other methods that read, or may end the program, flush and go
+    // on to the runtime's. substr only ends it when its range is out of
+    // bounds.
+    struct { Symbol class_name; Symbol method_name; } _flushed[] = {
+        { IO, in_string }, { Object, cool_abort }, { Str, substr }
+    };
+    for (auto& method : _flushed) {
+        str << GetClassNode(method.class_name)->m_method_labels.at(method.method_name) << LABEL;
+        if (method.method_name == substr) {
+            int labelnum_flush = gen_state.labelnum++;
+            emit_load(T3, 2, SP, str);
+            emit_load(T3, 3, T3, str);
+            emit_load(T4, 1, SP, str);
+            emit_load(T4, 3, T4, str);
+            emit_blt(T3, ZERO, labelnum_flush, str);
+            emit_blt(T4, ZERO, labelnum_flush, str);
+            emit_addu(T3, T3, T4, str);
+            emit_load(T4, 3, ACC, str);
+            emit_load(T4, 3, T4, str);
+            emit_bgt(T3, T4, labelnum_flush, str);
+            str << JUMP;
+            emit_method_ref(method.class_name, method.method_name, str);
+            str << endl;
+            emit_label_def(labelnum_flush, str);
+        }
+        emit_move(T3, RA, str);
+        emit_jal(OUTFLUSH, str);
+        emit_move(RA, T3, str);
+        str << JUMP;
+        emit_method_ref(method.class_name, method.method_name, str);
+        str << endl << endl;
+    }
+
+    // The runtime calls Main.main once and then ends the program.
+    CgenNode* _main = GetClassNode(Main);
+    CgenNode* _main_impl = GetClassNode(_main->GetDispatchClassTab()[main_meth]);
+    emit_method_ref(Main, main_meth, str);
+    str << LABEL;
+    emit_push(RA, str);
+    emit_jal(_main_impl->m_method_labels.at(main_meth).c_str(), str);
+    emit_jal(OUTFLUSH, str);
+    emit_load(RA, 1, SP, str);
+    emit_addiu(SP, SP, 4, str);
+    emit_return(str);
+    str << endl;
+}
+
+// The counters of every class, in tag order, and what each counts: its
+// name, kind and class tag. The program leaves them in memory when it
+// ends, where mipsim reports them from. The counters of a dispatch site
+// share its name.
+void CgenClassTable::code_profile_tables() {
+    std::vector<ProfileSite> sites;
+    std::map<std::string, int> name_idx;
+
+    str << GLOBAL << PROFCOUNTS << endl
+        << GLOBAL << PROFNAMES << endl
+        << GLOBAL << PROFKINDS << endl
+        << GLOBAL << PROFTAGS << endl
+        << GLOBAL << PROFNUM << endl;
+    str << PROFCOUNTS << LABEL;
+    for (CgenNode* class_node : GetClassNodes()) {
+        str << class_node->name << PROFTAB_SUFFIX << LABEL;
+        if (!class_node->basic()) {
+            for (method_class* method : class_node->GetMethods()) {
+                sites.push_back(ProfileSite { class_node->m_method_labels.at(method->name),
+                                              PROFILE_CALL, class_node->class_tag });
+                str << WORD << 0 << endl;
+            }
+        }
+        for (const ProfileSite& site : class_node->m_profile_sites) {
+            sites.push_back(site);
+            str << WORD << 0 << endl;
+        }
+    }
+
+    str << PROFNAMES << LABEL;
+    for (const ProfileSite& site : sites) {
+        auto iter = name_idx.insert(std::make_pair(site.name, (int)name_idx.size())).first;
+        str << WORD << PROFNAMES << iter->second << endl;
+    }
+    str << PROFKINDS << LABEL;
+    for (const ProfileSite& site : sites) {
+        str << WORD << site.kind << endl;
+    }
+    str << PROFTAGS << LABEL;
+    for (const ProfileSite& site : sites) {
+        str << WORD << site.tag << endl;
+    }
+    str << PROFNUM << LABEL << WORD << sites.size() << endl;
+    for (auto& name : name_idx) {
+        str << PROFNAMES << name.second << LABEL;
+        emit_string_constant(str, (char*)name.first.c_str());
+    }
+    str << ALIGN;
+}
+
+void CgenClassTable::code_abort_stubs() {
+    for (const AbortStub& stub : gen_state.abort_stubs) {
+        label_scope = stub.scope;
+        emit_label_def(stub.label, str);
+        if (IsOutputBuffered()) {
+            emit_jal(OUTFLUSH, str);
+        }
+        if (stub.filename != nullptr) {
+            emit_load_string(ACC, stub.filename, str);
+            emit_load_imm(T1, stub.line, str);
+        }
+        emit_jal(stub.routine, str);
+    }
+}
+
+CgenClassTable::CgenClassTable(Classes classes, ostream& s) : nds(NULL) , str(s) {
 
     enterscope();
     if (cgen_debug) {
@@ -1223,10 +2286,23 @@ void CgenClassTable::code() {
     }
     code_select_gc();
 
-    if (cgen_debug) {
-        cout << "coding constants" << endl;
+    //
+    // Add constants that are required by the code generator.
+    //
+    stringtable.add_string("");
+    inttable.add_string("0");
+
+    // The constants go here, but which are referenced is only known once
+    // everything after them has been generated, so that goes to a buffer.
+    std::ostringstream rest;
+    std::streambuf* out = str.rdbuf(rest.rdbuf());
+
+    for (CgenNode* class_node : GetClassNodes()) {
+        class_node->RenderLabels();
+    }
+    if (cgen_profile_file != nullptr) {
+        LoadReceiverProfile(cgen_profile_file);
     }
-    code_constants();
 
     if (cgen_debug) {
         cout << "coding name table" << endl;
@@ -1254,18 +2330,57 @@ void CgenClassTable::code() {
     }
     code_global_text();
 
-    if (cgen_debug) {
-        cout << "coding object initializers" << endl;
+    if (cgen_optimize) {
+        if (cgen_debug) {
+            cout << "finding objects to allocate in frames" << endl;
+        }
+        AnalyzeEscapes();
     }
-    code_class_inits();
 
     if (cgen_debug) {
-        cout << "coding class methods" << endl;
+        cout << "coding object initializers and class methods" << endl;
     }
-    code_class_methods();
+    code_class_text();
     //                   - the class methods
     //                   - etc...
 
+    if (cgen_regargs) {
+        if (cgen_debug) {
+            cout << "coding register args adapters" << endl;
+        }
+        code_regargs_adapters();
+    }
+
+    if (cgen_debug) {
+        cout << "coding abort stubs" << endl;
+    }
+    code_abort_stubs();
+
+    if (IsOutputBuffered()) {
+        if (cgen_debug) {
+            cout << "coding buffered IO" << endl;
+        }
+        code_buffered_io();
+    }
+
+    str.rdbuf(out);
+    if (cgen_debug) {
+        cout << "coding constants" << endl;
+    }
+    code_constants();
+    if (cgen_profile) {
+        if (cgen_debug) {
+            cout << "coding profile tables" << endl;
+        }
+        code_profile_tables();
+    }
+    str << rest.str();
+
+    if (cgen_debug && cgen_Memmgr == GC_GENGC) {
+        cerr << "write barriers: " << gen_state.write_barriers_emitted << " emitted, "
+             << gen_state.write_barriers_elided << " elided" << endl;
+    }
+
 }
 
 
@@ -1299,6 +2414,104 @@ CgenNode::CgenNode(Class_ nd, Basicness bstatus, CgenClassTableP ct) :
 //
 //*****************************************************************
 
+//
+// Nullness analysis. IsNonVoid proves that an expression, once evaluated,
+// is not void: values of the basic classes, self and new objects never
+// are, and vars and params are tracked in Environment::m_non_void as the
+// method is generated. A var or param becomes non-void once it has been
+// dispatched or cased on, or assigned a non-void value; facts are joined
+// at the end of if and case, and dropped at loops.
+//
+static std::set<int> IntersectFacts(const std::set<int>& a, const std::set<int>& b) {
+    std::set<int> ret;
+    std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::inserter(ret, ret.begin()));
+    return ret;
+}
+
+static bool IsSelfObject(Expression expr) {
+    object_class* _object = dynamic_cast<object_class*>(expr);
+    return _object != nullptr && _object->name == self;
+}
+
+static bool IsNonVoid(Expression expr, Environment& env) {
+    Symbol type = expr->get_type();
+    if (type == Int || type == Bool || type == Str) {
+        return true;
+    }
+    if (object_class* _object = dynamic_cast<object_class*>(expr)) {
+        return _object->name == self || env.IsKnownNonVoid(_object->name);
+    }
+    if (dynamic_cast<new__class*>(expr) != nullptr) {
+        return true;
+    }
+    if (assign_class* _assign = dynamic_cast<assign_class*>(expr)) {
+        return IsNonVoid(_assign->expr, env);
+    }
+    if (block_class* _block = dynamic_cast<block_class*>(expr)) {
+        Expressions body = _block->body;
+        return IsNonVoid(body->nth(body->len() - 1), env);
+    }
+    if (cond_class* _cond = dynamic_cast<cond_class*>(expr)) {
+        return IsNonVoid(_cond->then_exp, env) && IsNonVoid(_cond->else_exp, env);
+    }
+    return false;
+}
+
+// If pred tests whether a var or param x is void, returns x and sets
+// void_if_true to whether pred is true exactly when x is void.
+static Symbol GetVoidTested(Expression pred, bool& void_if_true) {
+    bool negated = false;
+    while (comp_class* _comp = dynamic_cast<comp_class*>(pred)) {
+        negated = !negated;
+        pred = _comp->e1;
+    }
+    isvoid_class* _isvoid = dynamic_cast<isvoid_class*>(pred);
+    if (_isvoid == nullptr) {
+        return nullptr;
+    }
+    object_class* _object = dynamic_cast<object_class*>(_isvoid->e1);
+    if (_object == nullptr) {
+        return nullptr;
+    }
+    void_if_true = !negated;
+    return _object->name;
+}
+
+// Returns the label of the stub calling the abort routine with the file and
+// line of expr. Routines taking no position get a single shared stub.
+static int GetAbortStub(const char* routine, Expression expr, Environment& env) {
+    StringEntry* filename = nullptr;
+    int line = 0;
+    if (expr != nullptr) {
+        filename = stringtable.lookup_string(env.m_class_node->get_filename()->get_string());
+        line = expr->get_line_number();
+    }
+    auto key = std::make_tuple(std::string(routine), filename, line);
+    auto iter = gen_state.abort_stub_labels.find(key);
+    if (iter != gen_state.abort_stub_labels.end()) {
+        return iter->second;
+    }
+    AbortStub stub = { label_scope, gen_state.labelnum++, routine, filename, line };
+    gen_state.abort_stubs.push_back(stub);
+    gen_state.abort_stub_labels[key] = stub.label;
+    return stub.label;
+}
+
+// Emits the void check of a dispatch unless the receiver, now in ACC,
+// is known not to be void. Afterwards it is.
+static void emit_dispatch_void_check(Expression dispatch, Expression receiver, Environment& env, ostream& s) {
+    if (IsNonVoid(receiver, env)) {
+        return;
+    }
+
+    s << "\t# if obj = void: abort" << endl;
+    emit_beqz(ACC, GetAbortStub("_dispatch_abort", dispatch, env), s);
+
+    if (object_class* _object = dynamic_cast<object_class*>(receiver)) {
+        env.SetNonVoid(_object->name, true);
+    }
+}
+
 void assign_class::code(ostream& s, Environment env) {
     s << "\t# Assign. First eval the expr." << endl;
     expr->code(s, env);
@@ -1308,481 +2521,1295 @@ void assign_class::code(ostream& s, Environment env) {
 
     if ((idx = env.LookUpVar(name)) != -1) {
         s << "\t# It is a let variable." << endl;
-        emit_store(ACC, idx + 1, SP, s);
-        if (cgen_Memmgr == 1) {
-            emit_addiu(A1, SP, 4 * (idx + 1), s);
-            emit_jal("_GenGC_Assign", s);
-        }
+        emit_store_slot(ACC, idx, s);
+        env.SetNonVoid(name, IsNonVoid(expr, env));
     } else if ((idx = env.LookUpParam(name)) != -1){
         s << "\t# It is a param." << endl;
-        emit_store(ACC, idx + 3, FP, s);
-        if (cgen_Memmgr == 1) {
-            emit_addiu(A1, FP, 4 * (idx + 3), s);
-            emit_jal("_GenGC_Assign", s);
+        if (const char* reg = env.LookUpParamReg(idx)) {
+            emit_move(reg, ACC, s);
+        } else {
+            emit_store(ACC, idx + 3, FP, s);
         }
+        env.SetNonVoid(name, IsNonVoid(expr, env));
     }
     else if ((idx = env.LookUpAttrib(name)) != -1) {
         s << "\t# It is an attribute." << endl;
         emit_store(ACC, idx + 3, SELF, s);
-        if (cgen_Memmgr == 1) {
-            emit_addiu(A1, SELF, 4 * (idx + 3), s);
-            emit_jal("_GenGC_Assign", s);
-        }
-
+        emit_write_barrier(idx + 3, !expr->IsStaticValue(), env.m_class_node, s);
     } else {
         s << "Error! assign to what?" << endl;
     }
 }
 
-void static_dispatch_class::code(ostream& s, Environment env) {
-    s << "\t# Static dispatch. First eval and save the params." << endl;
-
-    std::vector<Expression> actuals = GetActuals();
-    Environment new_env = env;
-    for (Expression expr : actuals) {
-        expr->code(s, env);
-        emit_push(ACC, s);
-        env.EnterScope();
-        env.AddObstacle();
-    }
-
-    s << "\t# eval the obj in dispatch." << endl;
-    expr->code(s, env);
-
-    s << "\t# if obj = void: abort" << endl;
-    emit_bne(ACC, ZERO, labelnum, s);
-    s << LA << ACC << " str_const0" << endl;
-    emit_load_imm(T1, 1, s);
-    emit_jal("_dispatch_abort", s);
-
-    emit_label_def(labelnum, s);
-    ++labelnum;
-
-    Symbol _class_name = type_name;
-    CgenNode* _class_node = codegen_classtable->GetClassNode(type_name);
-    s << "\t# Now we locate the method in the dispatch table." << endl;
-    s << "\t# t1 = " << type_name << ".dispTab" << endl;
-
-    std::string addr = type_name->get_string();
-    addr += DISPTAB_SUFFIX;
-    emit_load_address(T1, addr.c_str(), s);
-
-    s << endl;
-
-    int idx = _class_node->GetDispatchIdxTab()[name];
-    s << "\t# t1 = dispTab[offset]" << endl;
-    emit_load(T1, idx, T1, s);
-    s << endl;
+// Call the implementation of method_name seen by class_node, i.e. the
+// method its dispatch table would hold, without going through the table.
+static void emit_direct_call(CgenNode* class_node, Symbol method_name, ostream& s) {
+    Symbol _impl_class = class_node->GetDispatchClassTab()[method_name];
 
-    s << "\t# jumpto " << name << endl;
-    emit_jalr(T1, s);
+    s << "\t# jumpto " << _impl_class << METHOD_SEP << method_name << endl;
+    emit_jal(codegen_classtable->GetClassNode(_impl_class)->m_method_labels.at(method_name).c_str(), s);
     s << endl;
-
 }
 
-void dispatch_class::code(ostream& s, Environment env) {
-    s << "\t# Dispatch. First eval and save the params." << endl;
-    std::vector<Expression> actuals = GetActuals();
-
-    for (Expression expr : actuals) {
-        expr->code(s, env);
-        emit_push(ACC, s);
-        env.AddObstacle();
+// Returns true if no subclass of class_node overrides method_name, so
+// that a dispatch on a receiver of static type class_node always runs
+// the same implementation.
+static bool IsMonomorphic(CgenNode* class_node, Symbol method_name) {
+    Symbol _impl_class = class_node->GetDispatchClassTab()[method_name];
+    std::vector<CgenNode*> _class_nodes = codegen_classtable->GetClassNodes();
+    for (int tag = class_node->class_tag + 1; tag <= class_node->class_tag_end; ++tag) {
+        if (_class_nodes[tag]->GetDispatchClassTab()[method_name] != _impl_class) {
+            return false;
+        }
     }
+    return true;
+}
 
-    s << "\t# eval the obj in dispatch." << endl;
-    expr->code(s, env);
-
-    s << "\t# if obj = void: abort" << endl;
-    emit_bne(ACC, ZERO, labelnum, s);
-    s << LA << ACC << " str_const0" << endl;
-    emit_load_imm(T1, 1, s);
-    emit_jal("_dispatch_abort", s);
-
-    emit_label_def(labelnum, s);
-    ++labelnum;
+// The implementation of method_name that class_node's dispatch table holds.
+static method_class* GetTargetMethod(CgenNode* class_node, Symbol method_name) {
+    CgenNode* _impl_class = codegen_classtable->GetClassNode(
+        class_node->GetDispatchClassTab()[method_name]);
+    return _impl_class->GetFullMethods()[_impl_class->GetDispatchIdxTab()[method_name]];
+}
 
-    // Get current class name;
-    Symbol _class_name = env.m_class_node->name;
-    if (expr->get_type() != SELF_TYPE) {
-        _class_name = expr->get_type();
+// Inlining. A call whose target is known is replaced by the callee's body
+// when the body has at most INLINE_SIZE_BUDGET expression nodes and the
+// callee is not already being generated (see inline_stack), which stops
+// recursive methods from being expanded forever.
+static method_class* GetInlineTarget(CgenNode* class_node, Symbol method_name) {
+    CgenNode* _impl_class = codegen_classtable->GetClassNode(
+        class_node->GetDispatchClassTab()[method_name]);
+    if (_impl_class->basic()) {
+        // Basic methods are implemented in the runtime.
+        return nullptr;
     }
 
-    CgenNode* _class_node = codegen_classtable->GetClassNode(_class_name);
-    s << "\t# Now we locate the method in the dispatch table." << endl;
-    s << "\t# t1 = self.dispTab" << endl;
-    emit_load(T1, 2, ACC, s);
-    s << endl;
-
-    int idx = _class_node->GetDispatchIdxTab()[name];
-    s << "\t# t1 = dispTab[offset]" << endl;
-    emit_load(T1, idx, T1, s);
-    s << endl;
-
-    s << "\t# jumpto " << name << endl;
-    emit_jalr(T1, s);
-    s << endl;
-
+    method_class* _method = GetTargetMethod(class_node, method_name);
+    if (_method->expr->GetSize() > INLINE_SIZE_BUDGET) {
+        return nullptr;
+    }
+    if (std::find(inline_stack.begin(), inline_stack.end(), _method) != inline_stack.end()) {
+        return nullptr;
+    }
+    return _method;
 }
 
-void cond_class::code(ostream& s, Environment env) {
-    s << "\t# If statement. First eval condition." << endl;
-    pred->code(s, env);
-
-    s << "\t# extract the bool content from acc to t1" << endl;
-    emit_fetch_int(T1, ACC, s);
-    s << endl;
+// The receiver is in ACC and the actuals are in the innermost slots of
+// env. The callee's formals become let variables over those slots, and
+// self is saved in the next slot and rebound for the duration of the body.
+static void emit_inline_call(CgenNode* class_node, method_class* method, Environment env, ostream& s) {
+    Symbol _impl_class = class_node->GetDispatchClassTab()[method->name];
+    s << "\t# inline " << _impl_class << METHOD_SEP << method->name << endl;
+
+    // The caller's slots stay reserved, but the callee cannot name them.
+    Environment callee_env;
+    callee_env.m_class_node = codegen_classtable->GetClassNode(_impl_class);
+    callee_env.m_max_slots = env.m_max_slots;
+    callee_env.EnterScope();
+    int first_slot = env.m_var_idx_tab.size() - method->GetArgNum();
+    for (int i = 0; i < first_slot; ++i) {
+        callee_env.AddVar(No_class);
+    }
+    for (int i = method->formals->first(); method->formals->more(i); i = method->formals->next(i)) {
+        callee_env.AddVar(method->formals->nth(i)->GetName());
+    }
+    // Only now, so that re-adding the slots keeps the caller's facts.
+    callee_env.m_non_void = env.m_non_void;
 
-    int labelnum_false = labelnum++;
-    int labelnum_finish = labelnum++;
-    // labelnum : false.
-    // labelnum + 1: finish
-    s << "\t# if t1 == 0 goto false" << endl;
-    emit_beq(T1, ZERO, labelnum_false, s);
+    s << "\t# save s0, SELF = a0" << endl;
+    int self_slot = callee_env.AddObstacle();
+    emit_store_slot(SELF, self_slot, s);
+    emit_move(SELF, ACC, s);
     s << endl;
 
-    then_exp->code(s, env);
+    inline_stack.push_back(method);
+    method->expr->code(s, callee_env);
+    inline_stack.pop_back();
 
-    s << "\t# jumpt finish" << endl;
-    emit_branch(labelnum_finish, s);
+    s << "\t# restore s0" << endl;
+    emit_load_slot(SELF, self_slot, s);
     s << endl;
-
-    s << "# False:" << endl;
-    emit_label_def(labelnum_false, s);
-
-    else_exp->code(s, env);
-
-    s << "# Finish:" << endl;
-    emit_label_def(labelnum_finish, s);
-
 }
 
-void loop_class::code(ostream& s, Environment env) {
-    int start = labelnum;
-    int finish = labelnum + 1;
-    labelnum += 2;
-
-    s << "\t# While loop" << endl;
-    s << "\t# start:" << endl;
-    emit_label_def(start, s);
-
-    s << "\t# ACC = pred" << endl;
-    pred->code(s, env);
-
-    s << "\t# extract int inside bool" << endl;
-    emit_fetch_int(T1, ACC, s);
-    s << endl;
-
-    s << "\t# if pred == false jumpto finish" << endl;
-    emit_beq(T1, ZERO, finish, s);
-    s << endl;
-
-    body->code(s, env);
-
-    s << "\t# Jumpto start" << endl;
-    emit_branch(start, s);
+//////////////////////////////////////////////////////////////////////////////
+//
+// Escape analysis (-O)
+//
+// An object made by new T that cannot be reached once the method doing the
+// new has moved on is allocated in that method's frame instead of the heap
+// (see AnalyzeEscapes). It lives in slots reserved by the let it is bound
+// to, or by the call made on it, for as long as that expression runs.
+//
+//////////////////////////////////////////////////////////////////////////////
 
-    s << "\t# Finish:" << endl;
-    emit_label_def(finish, s);
-    
-    s << "\t# ACC = void" << endl;
-    emit_move(ACC, ZERO, s);
+static bool IsSelfSafe(CgenNode* class_node, method_class* method);
+static bool MayReturnSelf(CgenNode* class_node, method_class* method);
 
+// The method a call on an object of class x_class runs: the
+// implementation static_type sees for a static dispatch.
+static method_class* GetCalleeOn(CgenNode* x_class, Symbol static_type, Symbol method_name) {
+    CgenNode* _class_node = static_type == nullptr ? x_class : codegen_classtable->GetClassNode(static_type);
+    return GetTargetMethod(_class_node, method_name);
 }
 
-void typcase_class::code(ostream& s, Environment env) {
-    std::map<Symbol, int> _class_tags = codegen_classtable->GetClassTags();
-    std::vector<CgenNode*> _class_nodes = codegen_classtable->GetClassNodes();
-    
-    s << "\t# case expr" << endl;
-    s << "\t# First eval e0" << endl;
-    expr->code(s, env);
-
-    s << "\t# If e0 = void, abort" << endl;
-    emit_bne(ACC, ZERO, labelnum, s);
-    emit_load_address(ACC, "str_const0", s);
-    emit_load_imm(T1, 1, s);
-    emit_jal("_case_abort2", s);
-
-    emit_label_def(labelnum, s);
-    ++labelnum;
+static Expression GetReceiver(Expression expr, Symbol& static_type, Symbol& method_name,
+                              std::vector<Expression>& actuals) {
+    if (dispatch_class* _dispatch = dynamic_cast<dispatch_class*>(expr)) {
+        static_type = nullptr;
+        method_name = _dispatch->name;
+        actuals = _dispatch->GetActuals();
+        return _dispatch->expr;
+    }
+    if (static_dispatch_class* _dispatch = dynamic_cast<static_dispatch_class*>(expr)) {
+        static_type = _dispatch->type_name;
+        method_name = _dispatch->name;
+        actuals = _dispatch->GetActuals();
+        return _dispatch->expr;
+    }
+    return nullptr;
+}
 
-    s << "\t# T1 = type(acc)" << endl;
-    emit_load(T1, 0, ACC, s);
+// The operands of the arithmetic, comparisons and isvoid, whose values
+// are only looked at.
+static std::vector<Expression> GetOperands(Expression expr) {
+    if (plus_class* _e = dynamic_cast<plus_class*>(expr)) return { _e->e1, _e->e2 };
+    if (sub_class* _e = dynamic_cast<sub_class*>(expr)) return { _e->e1, _e->e2 };
+    if (mul_class* _e = dynamic_cast<mul_class*>(expr)) return { _e->e1, _e->e2 };
+    if (divide_class* _e = dynamic_cast<divide_class*>(expr)) return { _e->e1, _e->e2 };
+    if (lt_class* _e = dynamic_cast<lt_class*>(expr)) return { _e->e1, _e->e2 };
+    if (leq_class* _e = dynamic_cast<leq_class*>(expr)) return { _e->e1, _e->e2 };
+    if (eq_class* _e = dynamic_cast<eq_class*>(expr)) return { _e->e1, _e->e2 };
+    if (neg_class* _e = dynamic_cast<neg_class*>(expr)) return { _e->e1 };
+    if (comp_class* _e = dynamic_cast<comp_class*>(expr)) return { _e->e1 };
+    if (isvoid_class* _e = dynamic_cast<isvoid_class*>(expr)) return { _e->e1 };
+    return {};
+}
 
-    std::vector<branch_class*> _cases = GetCases();
-    int labelbeg = labelnum;
-    int finish = labelnum + _cases.size();
-    int caseidx = 0;
-    labelnum += _cases.size() + 1;
-
-    auto GetChildrenTagsSet = [&](std::vector<int> __curr_tags) {
-        std::vector<int> __children_tags; // for return.
-        for (int __curr_tag : __curr_tags) { // find children of this class.
-            CgenNode* __curr_node = _class_nodes[__curr_tag];
-            std::vector<CgenNode*> __children_nodes = __curr_node->GetChildren();
-            for (CgenNode* __children_node : __children_nodes) {
-                int __children_tag = _class_tags[__children_node->name];
-                if (std::find(__children_tags.begin(), __children_tags.end(), __children_tag) == __children_tags.end()) {
-                    __children_tags.push_back(__children_tag);
-                }
+// True if the value of expr may be the object x names, an x_class.
+static bool MayBeObject(Expression expr, Symbol x, CgenNode* x_class) {
+    Symbol _static_type;
+    Symbol _method_name;
+    std::vector<Expression> _actuals;
+    if (object_class* _object = dynamic_cast<object_class*>(expr)) {
+        return _object->name == x;
+    }
+    if (Expression _receiver = GetReceiver(expr, _static_type, _method_name, _actuals)) {
+        return MayBeObject(_receiver, x, x_class) &&
+               MayReturnSelf(x_class, GetCalleeOn(x_class, _static_type, _method_name));
+    }
+    if (assign_class* _assign = dynamic_cast<assign_class*>(expr)) {
+        return MayBeObject(_assign->expr, x, x_class);
+    }
+    if (cond_class* _cond = dynamic_cast<cond_class*>(expr)) {
+        return MayBeObject(_cond->then_exp, x, x_class) || MayBeObject(_cond->else_exp, x, x_class);
+    }
+    if (block_class* _block = dynamic_cast<block_class*>(expr)) {
+        return MayBeObject(_block->body->nth(_block->body->len() - 1), x, x_class);
+    }
+    if (let_class* _let = dynamic_cast<let_class*>(expr)) {
+        return _let->identifier != x && MayBeObject(_let->body, x, x_class);
+    }
+    if (typcase_class* _typcase = dynamic_cast<typcase_class*>(expr)) {
+        for (branch_class* _case : _typcase->GetCases()) {
+            if (_case->name != x && MayBeObject(_case->expr, x, x_class)) {
+                return true;
             }
         }
-        return __children_tags;
-    };
+    }
+    return false;
+}
 
-    auto HasFinished = [&](std::vector<std::vector<int> > __cases_tags) {
-        for (std::vector<int> __case_tags : __cases_tags) {
-            if (!__case_tags.empty()) {
-                return false;
+// True if the object x names, an x_class, may be reachable from anywhere
+// but x once expr has run: stored in an attribute or another var, passed
+// to a method, or used by a call that may do so. value_escapes is true
+// when the value of expr is itself stored or returned.
+static bool Escapes(Expression expr, Symbol x, CgenNode* x_class, bool value_escapes) {
+    Symbol _static_type;
+    Symbol _method_name;
+    std::vector<Expression> _actuals;
+    if (object_class* _object = dynamic_cast<object_class*>(expr)) {
+        return _object->name == x && value_escapes;
+    }
+    if (Expression _receiver = GetReceiver(expr, _static_type, _method_name, _actuals)) {
+        for (Expression actual : _actuals) {
+            if (Escapes(actual, x, x_class, true)) {
+                return true;
             }
         }
-        return true;
-    };
-
-    // Generate first round cases_tags.
-    std::vector<std::vector<int> > cases_tags;
-    for (branch_class* _case : _cases) {
-        Symbol _type_decl = _case->type_decl;
-        int _class_tag = _class_tags[_type_decl];
-        std::vector<int> case_tags = { _class_tag };
-        cases_tags.push_back(case_tags);
-    }
-
-    while (!HasFinished(cases_tags)) {
-        // Print cases_tags.
-        for (int caseidx = 0; caseidx < cases_tags.size(); ++caseidx) {
-            std::vector<int> case_tags = cases_tags[caseidx];
-            for (int case_tag : case_tags) {
-                s << "\t# tag = " << case_tag << " : goto case " << caseidx << endl;
-                emit_load_imm(T2, case_tag, s);
-                emit_beq(T1, T2, labelbeg + caseidx, s);
-                s << endl;
-            }
-            
+        if (Escapes(_receiver, x, x_class, false)) {
+            return true;
         }
-        s << "\t# ----------------" << endl;
-
-        for (int i = 0; i < cases_tags.size(); ++i) {
-            cases_tags[i] = GetChildrenTagsSet(cases_tags[i]);
+        if (!MayBeObject(_receiver, x, x_class)) {
+            return false;
         }
+        method_class* _callee = GetCalleeOn(x_class, _static_type, _method_name);
+        return !IsSelfSafe(x_class, _callee) || (value_escapes && MayReturnSelf(x_class, _callee));
     }
-
-    s << "\t# No match" << endl;
-    emit_jal("_case_abort", s);
-    emit_branch(finish, s);
-    
-    for (branch_class* _case : _cases) {
-        Symbol _name = _case->name;
-        Symbol _type_decl = _case->type_decl;
-        Expression _expr = _case->expr;
-
-        s << "# eval expr " << caseidx << endl;
-        emit_label_def(labelbeg + caseidx, s);
-        env.EnterScope();
-        env.AddVar(_name);
-        emit_push(ACC, s);
-        _expr->code(s, env);
-        emit_addiu(SP, SP, 4, s);
-
-        s << "\t# Jumpto finish" << endl;
-        emit_branch(finish, s);
-        ++caseidx;
+    if (assign_class* _assign = dynamic_cast<assign_class*>(expr)) {
+        return _assign->name == x || Escapes(_assign->expr, x, x_class, true);
+    }
+    if (cond_class* _cond = dynamic_cast<cond_class*>(expr)) {
+        return Escapes(_cond->pred, x, x_class, false) ||
+               Escapes(_cond->then_exp, x, x_class, value_escapes) ||
+               Escapes(_cond->else_exp, x, x_class, value_escapes);
+    }
+    if (loop_class* _loop = dynamic_cast<loop_class*>(expr)) {
+        return Escapes(_loop->pred, x, x_class, false) || Escapes(_loop->body, x, x_class, false);
+    }
+    if (block_class* _block = dynamic_cast<block_class*>(expr)) {
+        Expressions body = _block->body;
+        for (int i = body->first(); body->more(i); i = body->next(i)) {
+            if (Escapes(body->nth(i), x, x_class, body->more(body->next(i)) ? false : value_escapes)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    if (let_class* _let = dynamic_cast<let_class*>(expr)) {
+        // A let of the same name hides x in its body.
+        return Escapes(_let->init, x, x_class, true) ||
+               (_let->identifier != x && Escapes(_let->body, x, x_class, value_escapes));
     }
+    if (typcase_class* _typcase = dynamic_cast<typcase_class*>(expr)) {
+        // The branch taken binds the object matched on.
+        if (Escapes(_typcase->expr, x, x_class, true)) {
+            return true;
+        }
+        for (branch_class* _case : _typcase->GetCases()) {
+            if (_case->name != x && Escapes(_case->expr, x, x_class, value_escapes)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    for (Expression operand : GetOperands(expr)) {
+        if (Escapes(operand, x, x_class, false)) {
+            return true;
+        }
+    }
+    return false;
+}
 
-    s << "#finish:" << endl;
-    emit_label_def(finish, s);
-    s << endl;
+// Whether method, run on an object of class class_node, leaves self
+// reachable from anywhere but its caller, and whether it may return self.
+// Both are memoized; a method whose answer is being worked out, which is
+// the case for recursive calls, is taken to be unsafe and to return self.
+static std::map<std::pair<CgenNode*, method_class*>, bool> self_safe_memo;
+static std::map<std::pair<CgenNode*, method_class*>, bool> returns_self_memo;
+
+static bool IsSelfSafe(CgenNode* class_node, method_class* method) {
+    if (method->expr->IsEmpty()) {
+        // The runtime's methods store nothing; Object.copy copies.
+        return true;
+    }
+    std::pair<CgenNode*, method_class*> key(class_node, method);
+    auto memo = self_safe_memo.find(key);
+    if (memo != self_safe_memo.end()) {
+        return memo->second;
+    }
+    self_safe_memo[key] = false;
+    bool ret = !Escapes(method->expr, self, class_node, false);
+    self_safe_memo[key] = ret;
+    return ret;
 }
 
-void block_class::code(ostream& s, Environment env) {
-    for (int i = body->first(); body->more(i); i = body->next(i)) {
-        body->nth(i)->code(s, env);
+static bool MayReturnSelf(CgenNode* class_node, method_class* method) {
+    if (method->expr->IsEmpty()) {
+        return method->name == out_string || method->name == out_int;
+    }
+    std::pair<CgenNode*, method_class*> key(class_node, method);
+    auto memo = returns_self_memo.find(key);
+    if (memo != returns_self_memo.end()) {
+        return memo->second;
     }
+    returns_self_memo[key] = true;
+    bool ret = MayBeObject(method->expr, self, class_node);
+    returns_self_memo[key] = ret;
+    return ret;
 }
 
-void let_class::code(ostream& s, Environment env) {
-    s << "\t# Let expr" << endl;
-    s << "\t# First eval init" << endl;
-    init->code(s, env);
+// True if the attribute initializers of class_node and its ancestors
+// leave a new object reachable only from whoever made it.
+static bool IsInitSelfSafe(CgenNode* class_node) {
+    if (class_node->basic()) {
+        return true;
+    }
+    for (attr_class* attrib : class_node->GetFullAttribs()) {
+        if (Escapes(attrib->init, self, class_node, true)) {
+            return false;
+        }
+    }
+    return true;
+}
 
-    if (init->IsEmpty()) {
-        // We still need to deal with basic types.
-        if (type_decl == Str) {
-            emit_load_string(ACC, stringtable.lookup_string(""), s);
-        } else if (type_decl == Int) {
-            emit_load_int(ACC, inttable.lookup_string("0"), s);
-        } else if (type_decl == Bool) {
-            emit_load_bool(ACC, BoolConst(0), s);
+// If expr is new T, or a chain of calls on new T that all leave the object
+// where it is, returns the new; may_be_object is set to whether the value
+// of expr may be the object.
+static new__class* GetStackObject(Expression expr, bool& may_be_object) {
+    if (new__class* _new = dynamic_cast<new__class*>(expr)) {
+        if (_new->type_name == SELF_TYPE) {
+            return nullptr;
         }
+        CgenNode* _class_node = codegen_classtable->GetClassNode(_new->type_name);
+        if (_class_node->basic() || !IsInitSelfSafe(_class_node)) {
+            return nullptr;
+        }
+        may_be_object = true;
+        return _new;
+    }
+    Symbol _static_type;
+    Symbol _method_name;
+    std::vector<Expression> _actuals;
+    Expression _receiver = GetReceiver(expr, _static_type, _method_name, _actuals);
+    if (_receiver == nullptr) {
+        return nullptr;
+    }
+    new__class* _new = GetStackObject(_receiver, may_be_object);
+    if (_new == nullptr || !may_be_object) {
+        return _new;
     }
+    CgenNode* _class_node = codegen_classtable->GetClassNode(_new->type_name);
+    method_class* _callee = GetCalleeOn(_class_node, _static_type, _method_name);
+    if (!IsSelfSafe(_class_node, _callee)) {
+        return nullptr;
+    }
+    may_be_object = MayReturnSelf(_class_node, _callee);
+    return _new;
+}
 
-    s << "\t# push" << endl;
-    emit_push(ACC, s);
-    s << endl;
+static void FindStackObjects(Expression expr, bool value_escapes);
+
+// The actuals of a chain of calls, and its innermost receiver, which are
+// not made in the frame.
+static void FindStackObjectsInChain(Expression expr) {
+    Symbol _static_type;
+    Symbol _method_name;
+    std::vector<Expression> _actuals;
+    Expression _receiver = GetReceiver(expr, _static_type, _method_name, _actuals);
+    if (_receiver == nullptr) {
+        if (dynamic_cast<new__class*>(expr) == nullptr) {
+            FindStackObjects(expr, true);
+        }
+        return;
+    }
+    for (Expression actual : _actuals) {
+        FindStackObjects(actual, true);
+    }
+    FindStackObjectsInChain(_receiver);
+}
 
-    env.EnterScope();
-    env.AddVar(identifier);
+// Finds the news in expr whose objects can be allocated in the frame and
+// records them in stack_object_owners.
+static void FindStackObjects(Expression expr, bool value_escapes) {
+    bool _may_be_object = false;
+    if (let_class* _let = dynamic_cast<let_class*>(expr)) {
+        new__class* _new = GetStackObject(_let->init, _may_be_object);
+        CgenNode* _class_node = _new == nullptr ? nullptr : codegen_classtable->GetClassNode(_new->type_name);
+        if (_new != nullptr &&
+            !(_may_be_object && Escapes(_let->body, _let->identifier, _class_node, value_escapes))) {
+            stack_object_owners[_let] = _new;
+            FindStackObjectsInChain(_let->init);
+        } else {
+            FindStackObjects(_let->init, true);
+        }
+        FindStackObjects(_let->body, value_escapes);
+        return;
+    }
+    Symbol _static_type;
+    Symbol _method_name;
+    std::vector<Expression> _actuals;
+    if (GetReceiver(expr, _static_type, _method_name, _actuals) != nullptr) {
+        // Only the outermost call of a chain on a new object can own it.
+        new__class* _new = GetStackObject(expr, _may_be_object);
+        if (_new != nullptr && !(_may_be_object && value_escapes)) {
+            stack_object_owners[expr] = _new;
+        }
+        FindStackObjectsInChain(expr);
+        return;
+    }
+    if (assign_class* _assign = dynamic_cast<assign_class*>(expr)) {
+        FindStackObjects(_assign->expr, true);
+    } else if (cond_class* _cond = dynamic_cast<cond_class*>(expr)) {
+        FindStackObjects(_cond->pred, false);
+        FindStackObjects(_cond->then_exp, value_escapes);
+        FindStackObjects(_cond->else_exp, value_escapes);
+    } else if (loop_class* _loop = dynamic_cast<loop_class*>(expr)) {
+        FindStackObjects(_loop->pred, false);
+        FindStackObjects(_loop->body, false);
+    } else if (block_class* _block = dynamic_cast<block_class*>(expr)) {
+        Expressions body = _block->body;
+        for (int i = body->first(); body->more(i); i = body->next(i)) {
+            FindStackObjects(body->nth(i), body->more(body->next(i)) ? false : value_escapes);
+        }
+    } else if (typcase_class* _typcase = dynamic_cast<typcase_class*>(expr)) {
+        FindStackObjects(_typcase->expr, true);
+        for (branch_class* _case : _typcase->GetCases()) {
+            FindStackObjects(_case->expr, value_escapes);
+        }
+    } else {
+        for (Expression operand : GetOperands(expr)) {
+            FindStackObjects(operand, false);
+        }
+    }
+}
 
-    body->code(s, env);
+// Runs before the classes are generated, which only read the results.
+void CgenClassTable::AnalyzeEscapes() {
+    for (CgenNode* class_node : GetClassNodes()) {
+        if (class_node->basic()) {
+            continue;
+        }
+        for (attr_class* attrib : class_node->GetAttribs()) {
+            FindStackObjects(attrib->init, true);
+        }
+        for (method_class* method : class_node->GetMethods()) {
+            FindStackObjects(method->expr, true);
+        }
+    }
+    for (auto& owner : stack_object_owners) {
+        CgenNode* _class_node = codegen_classtable->GetClassNode(owner.second->type_name);
+        for (; !_class_node->basic(); _class_node = _class_node->get_parentnd()) {
+            stack_object_classes.insert(_class_node);
+        }
+    }
+}
 
-    s << "\t# pop" << endl;
-    emit_addiu(SP, SP, 4, s);
+// Reserves the slots of object, words and the eyecatcher, in env, for as
+// long as the caller's env is in use.
+static void emit_reserve_stack_object(new__class* object, Environment& env, ostream& s) {
+    CgenNode* _class_node = codegen_classtable->GetClassNode(object->type_name);
+    int words = DEFAULT_OBJFIELDS + _class_node->GetFullAttribs().size();
+    s << "\t# reserve " << words + 1 << " slots for " << object->type_name << " in the frame" << endl;
+    stack_object_slots[object] = env.AddObstacle();
+    for (int i = 0; i < words; ++i) {
+        env.AddObstacle();
+    }
+}
+
+// A call on an object in the frame cannot be a tail call, which would pop
+// it. Only let vars are named in env.m_stack_objects; other receivers may
+// be anything when there are some.
+static bool MayBeInFrame(Expression receiver, Environment& env) {
+    if (env.m_stack_objects.empty()) {
+        return false;
+    }
+    object_class* _object = dynamic_cast<object_class*>(receiver);
+    if (_object == nullptr) {
+        return true;
+    }
+    return std::find(env.m_stack_objects.begin(), env.m_stack_objects.end(), _object->name) !=
+           env.m_stack_objects.end();
+}
+
+// Tail calls. A dispatch whose value is the value of the current method
+// does not need the current frame afterwards. A call to the current
+// method itself rebinds self, overwrites the params and loops back to the
+// body; any other call pops the frame, moves the actuals to where the
+// current method's own arguments were and jumps to the callee, which
+// returns straight to our caller. The actuals must not reach down into
+// the slots they are copied from, which limits the number of arguments,
+// and the receiver must not be in the frame.
+enum TailCall { TAIL_NONE, TAIL_SELF, TAIL_JUMP };
+
+static TailCall GetTailCall(Expression call, Expression receiver, method_class* target, int arg_num,
+                            Environment& env) {
+    if (env.m_tail_expr != call || MayBeInFrame(receiver, env)) {
+        return TAIL_NONE;
+    }
+    method_class* _current = inline_stack.front();
+    if (target == _current) {
+        return TAIL_SELF;
+    }
+    if (GetStackArgNum(arg_num) <= GetStackArgNum(_current->GetArgNum()) + 3) {
+        return TAIL_JUMP;
+    }
+    return TAIL_NONE;
+}
+
+// The receiver is in ACC and the actuals in the innermost slots of env.
+static void emit_self_tail_call(Expression receiver, int arg_num, Environment& env, ostream& s) {
+    s << "\t# Tail call to this method: set params and loop" << endl;
+    if (!IsSelfObject(receiver)) {
+        emit_move(SELF, ACC, s);
+    }
+    int first_slot = env.m_var_idx_tab.size() - arg_num;
+    for (int i = 0; i < arg_num; ++i) {
+        int idx = arg_num - 1 - i;
+        if (i >= env.m_reg_param_num) {
+            emit_load_slot(T1, first_slot + i, s);
+            emit_store(T1, idx + 3, FP, s);
+        } else if (const char* reg = env.LookUpParamReg(idx)) {
+            emit_load_slot(reg, first_slot + i, s);
+        } else {
+            // Stored to slot i by the prologue.
+            emit_load_slot(T1, first_slot + i, s);
+            emit_store_slot(T1, i, s);
+        }
+    }
+    if (body_label == -1) {
+        body_label = gen_state.labelnum++;
+    }
+    emit_branch(body_label, s);
     s << endl;
 }
 
-void plus_class::code(ostream& s, Environment env) {
-    s << "\t# Int operation : Add" << endl;
-    s << "\t# First eval e1 and push." << endl;
-    e1->code(s, env);
-    emit_push(ACC, s);
-    env.AddObstacle();
+// The receiver is in ACC and the actuals in the innermost slots of env.
+// Leaves the stack as if our caller had pushed the actuals itself.
+static void emit_tail_call_frame(int arg_num, Environment& env, ostream& s) {
+    int own_stack_arg_num = GetStackArgNum(inline_stack.front()->GetArgNum());
+    int reg_arg_num = GetRegArgNum(arg_num);
+    int stack_arg_num = arg_num - reg_arg_num;
+    s << "\t# Tail call: restore registers, replace frame by the actuals" << endl;
+    emit_load(RA, 0, FP, s);
+    emit_load(SELF, 1, FP, s);
+    emit_load(T2, 2, FP, s);
+    int first_slot = env.m_var_idx_tab.size() - arg_num;
+    for (int i = 0; i < stack_arg_num; ++i) {
+        emit_load_slot(T1, first_slot + reg_arg_num + i, s);
+        emit_store(T1, own_stack_arg_num + 2 - i, FP, s);
+    }
+    for (int i = 0; i < reg_arg_num; ++i) {
+        emit_load_slot(ARG_REGS[i], first_slot + i, s);
+    }
+    emit_addiu(SP, FP, 4 * (own_stack_arg_num + 2 - stack_arg_num), s);
+    emit_move(FP, T2, s);
+}
+
+// Actuals of a call are pushed, where the callee expects them, unless
+// the call is inlined or a tail call; then they are kept in slots.
+//
+// The register actuals of other calls are kept in slots too, unless what
+// is evaluated after them is only constants and names, which cannot call
+// anything or change any name. Then they go straight to their register,
+// or, if they are names themselves, are not evaluated yet. Constants and
+// self never change, so they are never evaluated early.
+// emit_reg_actuals moves the rest to $a1-$a3 right before the call.
+// Returns their slots: IN_REG for those already in their register,
+// NOT_EVALUATED for those not evaluated yet.
+//
+// A call that is known to go to the runtime pushes all its actuals, which
+// saves going through the adapter.
+enum ArgPassing { ARGS_PUSHED, ARGS_IN_SLOTS, ARGS_IN_REGS };
+
+static ArgPassing GetArgPassing(bool in_slots, bool direct, CgenNode* class_node, Symbol method_name) {
+    if (in_slots) {
+        return ARGS_IN_SLOTS;
+    }
+    Symbol _impl_class = class_node->GetDispatchClassTab()[method_name];
+    if (!cgen_regargs || (direct && codegen_classtable->GetClassNode(_impl_class)->basic())) {
+        return ARGS_PUSHED;
+    }
+    return ARGS_IN_REGS;
+}
+
+static const int IN_REG = -2;
+static const int NOT_EVALUATED = -1;
+
+static std::vector<int> emit_actuals(std::vector<Expression> actuals, Expression receiver,
+                                     ArgPassing passing, Environment& env, ostream& s) {
+    bool in_slots = passing == ARGS_IN_SLOTS;
+    int reg_arg_num = passing == ARGS_IN_REGS ? GetRegArgNum(actuals.size()) : 0;
+    std::vector<int> reg_slots;
+    int actual_num = actuals.size();
+    for (int i = 0; i < actual_num; ++i) {
+        Expression expr = actuals[i];
+        bool rest_is_names = !receiver->MayAllocate();
+        for (int j = i + 1; j < actual_num; ++j) {
+            rest_is_names = rest_is_names && !actuals[j]->MayAllocate();
+        }
+        bool constant = dynamic_cast<int_const_class*>(expr) != nullptr
+            || dynamic_cast<string_const_class*>(expr) != nullptr
+            || dynamic_cast<bool_const_class*>(expr) != nullptr || IsSelfObject(expr);
+        if (i < reg_arg_num && (constant || (rest_is_names && !expr->MayAllocate()))) {
+            reg_slots.push_back(NOT_EVALUATED);
+            continue;
+        }
+
+        expr->code(s, env);
+        if (i < reg_arg_num && rest_is_names) {
+            emit_move(ARG_REGS[i], ACC, s);
+            reg_slots.push_back(IN_REG);
+        } else if (i < reg_arg_num) {
+            int slot = env.AddObstacle();
+            emit_store_slot(ACC, slot, s);
+            reg_slots.push_back(slot);
+        } else if (in_slots) {
+            emit_store_slot(ACC, env.AddObstacle(), s);
+        } else {
+            emit_push(ACC, s);
+        }
+    }
+    return reg_slots;
+}
+
+// Loads the value of expr, which may not allocate (a constant or a name),
+// to dest without touching ACC.
+static void emit_load_value(const char* dest, Expression expr, Environment& env, ostream& s) {
+    if (int_const_class* _int = dynamic_cast<int_const_class*>(expr)) {
+        emit_load_int(dest, inttable.lookup_string(_int->token->get_string()), s);
+    } else if (string_const_class* _str = dynamic_cast<string_const_class*>(expr)) {
+        emit_load_string(dest, stringtable.lookup_string(_str->token->get_string()), s);
+    } else if (bool_const_class* _bool = dynamic_cast<bool_const_class*>(expr)) {
+        emit_load_bool(dest, BoolConst(_bool->val), s);
+    } else if (object_class* _object = dynamic_cast<object_class*>(expr)) {
+        int idx;
+        if ((idx = env.LookUpVar(_object->name)) != -1) {
+            emit_load_slot(dest, idx, s);
+        } else if ((idx = env.LookUpParam(_object->name)) != -1) {
+            if (const char* reg = env.LookUpParamReg(idx)) {
+                emit_move(dest, reg, s);
+            } else {
+                emit_load(dest, idx + 3, FP, s);
+            }
+        } else if ((idx = env.LookUpAttrib(_object->name)) != -1) {
+            emit_load(dest, idx + 3, SELF, s);
+        } else {
+            emit_move(dest, SELF, s);
+        }
+    } else {
+        emit_move(dest, ZERO, s);
+    }
+}
+
+static void emit_reg_actuals(std::vector<Expression> actuals, const std::vector<int>& reg_slots,
+                             Environment& env, ostream& s) {
+    if (reg_slots.empty()) {
+        return;
+    }
+    s << "\t# register args" << endl;
+    for (size_t i = 0; i < reg_slots.size(); ++i) {
+        if (reg_slots[i] == NOT_EVALUATED) {
+            emit_load_value(ARG_REGS[i], actuals[i], env, s);
+        } else if (reg_slots[i] != IN_REG) {
+            emit_load_slot(ARG_REGS[i], reg_slots[i], s);
+        }
+    }
+}
+
+void static_dispatch_class::code(ostream& s, Environment env) {
+    // The target is fixed at compile time, so call it directly.
+    CgenNode* _class_node = codegen_classtable->GetClassNode(type_name);
+    method_class* _method = GetInlineTarget(_class_node, name);
+    int arg_num = GetActuals().size();
+    TailCall tail = TAIL_NONE;
+    if (_method == nullptr) {
+        tail = GetTailCall(this, expr, GetTargetMethod(_class_node, name), arg_num, env);
+    }
+    auto _owned = stack_object_owners.find(this);
+    if (_owned != stack_object_owners.end() && tail == TAIL_NONE) {
+        emit_reserve_stack_object(_owned->second, env, s);
+    }
+
+    s << "\t# Static dispatch. First eval and save the params." << endl;
+    ArgPassing passing = GetArgPassing(_method != nullptr || tail != TAIL_NONE, true, _class_node, name);
+    std::vector<int> reg_slots = emit_actuals(GetActuals(), expr, passing, env, s);
+
+    s << "\t# eval the obj in dispatch." << endl;
+    expr->code(s, env);
+
+    emit_dispatch_void_check(this, expr, env, s);
+
+    if (_method != nullptr) {
+        emit_inline_call(_class_node, _method, env, s);
+    } else if (tail == TAIL_SELF) {
+        emit_self_tail_call(expr, arg_num, env, s);
+    } else if (tail == TAIL_JUMP) {
+        emit_tail_call_frame(arg_num, env, s);
+        s << JUMP;
+        emit_callee_ref(_class_node->GetDispatchClassTab()[name], name, s);
+        s << endl << endl;
+    } else {
+        emit_reg_actuals(GetActuals(), reg_slots, env, s);
+        emit_direct_call(_class_node, name, s);
+    }
+}
+
+void dispatch_class::code(ostream& s, Environment env) {
+    // Get current class name;
+    Symbol _class_name = env.m_class_node->name;
+    if (expr->get_type() != SELF_TYPE) {
+        _class_name = expr->get_type();
+    }
+
+    CgenNode* _class_node = codegen_classtable->GetClassNode(_class_name);
+
+    // If no subclass of the static type overrides the method the call is
+    // monomorphic. This always holds for Int, String and Bool, which
+    // cannot be inherited from.
+    bool monomorphic = IsMonomorphic(_class_node, name);
+    method_class* _method = nullptr;
+    method_class* _target = nullptr;
+    if (monomorphic) {
+        _method = GetInlineTarget(_class_node, name);
+        _target = GetTargetMethod(_class_node, name);
+    }
+    int arg_num = GetActuals().size();
+    TailCall tail = TAIL_NONE;
+    if (_method == nullptr) {
+        tail = GetTailCall(this, expr, _target, arg_num, env);
+    }
+    auto _owned = stack_object_owners.find(this);
+    if (_owned != stack_object_owners.end() && tail == TAIL_NONE) {
+        emit_reserve_stack_object(_owned->second, env, s);
+    }
+
+    s << "\t# Dispatch. First eval and save the params." << endl;
+    ArgPassing passing = GetArgPassing(_method != nullptr || tail != TAIL_NONE, monomorphic,
+                                       _class_node, name);
+    std::vector<int> reg_slots = emit_actuals(GetActuals(), expr, passing, env, s);
+
+    s << "\t# eval the obj in dispatch." << endl;
+    expr->code(s, env);
+
+    emit_dispatch_void_check(this, expr, env, s);
+
+    if (_method != nullptr) {
+        emit_inline_call(_class_node, _method, env, s);
+        return;
+    }
+    if (tail == TAIL_SELF) {
+        emit_self_tail_call(expr, arg_num, env, s);
+        return;
+    }
+    if (tail == TAIL_JUMP) {
+        emit_tail_call_frame(arg_num, env, s);
+    } else {
+        emit_reg_actuals(GetActuals(), reg_slots, env, s);
+    }
+    if (monomorphic) {
+        if (tail == TAIL_JUMP) {
+            s << JUMP;
+            emit_callee_ref(_class_node->GetDispatchClassTab()[name], name, s);
+            s << endl << endl;
+        } else {
+            emit_direct_call(_class_node, name, s);
+        }
+        return;
+    }
+
+    std::string site = GetDispatchSiteName(env.m_class_node, name, get_line_number());
+    if (cgen_profile) {
+        emit_receiver_count(_class_node, site, s);
+    }
+
+    // The receivers the profile saw most often are tested for first and
+    // their methods called directly, or inlined; the others go through
+    // the dispatch table.
+    std::vector<CgenNode*> hot = GetHotReceivers(site, _class_node);
+    int labelnum_finish = hot.empty() ? -1 : gen_state.labelnum++;
+    if (!hot.empty()) {
+        s << "\t# speculate on the class of the receiver" << endl;
+        emit_load(T2, 0, ACC, s);
+    }
+    for (CgenNode* hot_class : hot) {
+        int labelnum_next = gen_state.labelnum++;
+        emit_bne(T2, std::to_string(hot_class->class_tag).c_str(), labelnum_next, s);
+        method_class* _hot_method = nullptr;
+        if (tail == TAIL_NONE && arg_num == 0) {
+            _hot_method = GetInlineTarget(hot_class, name);
+        }
+        if (_hot_method != nullptr) {
+            emit_inline_call(hot_class, _hot_method, env, s);
+        } else {
+            if (tail == TAIL_JUMP) {
+                s << JUMP;
+            } else {
+                emit_partial_jal(s);
+            }
+            emit_callee_ref(hot_class->GetDispatchClassTab()[name], name, s);
+            s << endl;
+        }
+        if (tail != TAIL_JUMP) {
+            emit_branch(labelnum_finish, s);
+        }
+        emit_label_def(labelnum_next, s);
+    }
+
+    s << "\t# Now we locate the method in the dispatch table." << endl;
+    s << "\t# t1 = self.dispTab" << endl;
+    emit_load(T1, 2, ACC, s);
     s << endl;
 
-    s << "\t# Then eval e2 and make a copy for result." << endl;
-    e2->code(s, env);
-    emit_jal("Object.copy", s);
+    int idx = _class_node->GetDispatchIdxTab()[name];
+    s << "\t# t1 = dispTab[offset]" << endl;
+    emit_load(T1, idx, T1, s);
     s << endl;
 
-    s << "\t# Let's pop e1 to t1, move e2 to t2" << endl;
-    emit_addiu(SP, SP, 4, s);
-    emit_load(T1, 0, SP, s);
-    emit_move(T2, ACC, s);
+    s << "\t# jumpto " << name << endl;
+    if (tail == TAIL_JUMP) {
+        s << JR << T1 << endl;
+    } else {
+        emit_jalr(T1, s);
+    }
+    if (!hot.empty() && tail != TAIL_JUMP) {
+        emit_label_def(labelnum_finish, s);
+    }
     s << endl;
+}
 
-    s << "\t# Extract the int inside the object." << endl;
-    emit_load(T1, 3, T1, s);
-    emit_load(T2, 3, T2, s);
+// Evaluate the Int operands of a comparison and leave their values in t1
+// and t2.
+static void emit_int_operands(Expression e1, Expression e2, Environment env, ostream& s) {
+    s << "\t# First eval e1 and save it." << endl;
+    e1->code(s, env);
+    int slot = env.AddObstacle();
+    emit_store_slot(ACC, slot, s);
     s << endl;
 
-    s << "\t# Modify the int inside t2." << endl;
-    emit_add(T3, T1, T2, s);
-    emit_store(T3, 3, ACC, s);
+    s << "\t# Then eval e2." << endl;
+    e2->code(s, env);
     s << endl;
 
+    s << "\t# Extract the ints: t1 = e1, t2 = e2" << endl;
+    emit_load_slot(T1, slot, s);
+    emit_fetch_int(T1, T1, s);
+    emit_fetch_int(T2, ACC, s);
 }
 
-void sub_class::code(ostream& s, Environment env) {
-    s << "\t# Int operation : Sub" << endl;
-    s << "\t# First eval e1 and push." << endl;
-    e1->code(s, env);
-    emit_push(ACC, s);
-    env.AddObstacle();
+// How = compares its operands, by their static types: Int and Bool by
+// value, Strings and anything typed Object (which may hold an Int, Bool or
+// String) with equality_test, and all other objects by identity.
+enum EqKind {
+    EQ_VALUE,
+    EQ_IDENTITY,
+    EQ_RUNTIME
+};
+
+static EqKind GetEqKind(eq_class* eq) {
+    Symbol type1 = eq->e1->get_type();
+    Symbol type2 = eq->e2->get_type();
+    if ((type1 == Int || type1 == Bool) && type1 == type2) {
+        return EQ_VALUE;
+    }
+    if (type1 == Str || type2 == Str || type1 == Object || type2 == Object ||
+        (type1 != type2 && (type1 == Int || type1 == Bool || type2 == Int || type2 == Bool))) {
+        return EQ_RUNTIME;
+    }
+    return EQ_IDENTITY;
+}
+
+// Evaluates the operands of = to t1 and t2, as ints if they are compared
+// by value.
+static void emit_eq_operands(eq_class* eq, Environment env, ostream& s) {
+    if (GetEqKind(eq) == EQ_VALUE) {
+        emit_int_operands(eq->e1, eq->e2, env, s);
+        return;
+    }
+
+    s << "\t# First eval e1 and save it." << endl;
+    eq->e1->code(s, env);
+    int slot = env.AddObstacle();
+    emit_store_slot(ACC, slot, s);
     s << endl;
 
-    s << "\t# Then eval e2 and make a copy for result." << endl;
-    e2->code(s, env);
-    emit_jal("Object.copy", s);
+    s << "\t# Then eval e2." << endl;
+    eq->e2->code(s, env);
     s << endl;
 
-    s << "\t# Let's pop e1 to t1, move e2 to t2" << endl;
-    emit_addiu(SP, SP, 4, s);
-    emit_load(T1, 0, SP, s);
+    s << "\t# Let's load e1 to t1, move e2 to t2" << endl;
+    emit_load_slot(T1, slot, s);
     emit_move(T2, ACC, s);
     s << endl;
+}
 
-    s << "\t# Extract the int inside the object." << endl;
-    emit_load(T1, 3, T1, s);
-    emit_load(T2, 3, T2, s);
+// Jump to label if pred evaluates to branch_if, fall through otherwise.
+// Comparisons, not, isvoid and constants branch on their operands
+// directly instead of materializing a Bool.
+static void emit_cond_branch(Expression pred, bool branch_if, int label, Environment env, ostream& s) {
+    if (comp_class* _comp = dynamic_cast<comp_class*>(pred)) {
+        emit_cond_branch(_comp->e1, !branch_if, label, env, s);
+        return;
+    }
+
+    if (bool_const_class* _const = dynamic_cast<bool_const_class*>(pred)) {
+        if ((bool)_const->val == branch_if) {
+            emit_branch(label, s);
+        }
+        return;
+    }
+
+    if (lt_class* _lt = dynamic_cast<lt_class*>(pred)) {
+        emit_int_operands(_lt->e1, _lt->e2, env, s);
+        if (branch_if) {
+            emit_blt(T1, T2, label, s);
+        } else {
+            emit_bge(T1, T2, label, s);
+        }
+        return;
+    }
+
+    if (leq_class* _leq = dynamic_cast<leq_class*>(pred)) {
+        emit_int_operands(_leq->e1, _leq->e2, env, s);
+        if (branch_if) {
+            emit_bleq(T1, T2, label, s);
+        } else {
+            emit_bgt(T1, T2, label, s);
+        }
+        return;
+    }
+
+    if (isvoid_class* _isvoid = dynamic_cast<isvoid_class*>(pred)) {
+        _isvoid->e1->code(s, env);
+        if (branch_if) {
+            emit_beq(ACC, ZERO, label, s);
+        } else {
+            emit_bne(ACC, ZERO, label, s);
+        }
+        return;
+    }
+
+    eq_class* _eq = dynamic_cast<eq_class*>(pred);
+    if (_eq != nullptr && GetEqKind(_eq) != EQ_RUNTIME) {
+        emit_eq_operands(_eq, env, s);
+        if (branch_if) {
+            emit_beq(T1, T2, label, s);
+        } else {
+            emit_bne(T1, T2, label, s);
+        }
+        return;
+    }
+
+    pred->code(s, env);
+    s << "\t# extract the bool content from acc to t1" << endl;
+    emit_fetch_int(T1, ACC, s);
+    if (branch_if) {
+        emit_bne(T1, ZERO, label, s);
+    } else {
+        emit_beq(T1, ZERO, label, s);
+    }
+}
+
+void cond_class::code(ostream& s, Environment env) {
+    int labelnum_false = gen_state.labelnum++;
+    int labelnum_finish = gen_state.labelnum++;
+
+    s << "\t# If statement. if pred == false goto false" << endl;
+    emit_cond_branch(pred, false, labelnum_false, env, s);
     s << endl;
 
-    s << "\t# Modify the int inside t2." << endl;
-    emit_sub(T3, T1, T2, s);
-    emit_store(T3, 3, ACC, s);
+    // If pred is a void test, one of the branches knows the var is not void.
+    bool void_if_true = false;
+    Symbol _tested = GetVoidTested(pred, void_if_true);
+    std::set<int> _facts_else = *env.m_non_void;
+
+    if (_tested != nullptr && !void_if_true) {
+        env.SetNonVoid(_tested, true);
+    }
+    then_exp->code(s, env.ForTail(this, then_exp));
+    std::set<int> _facts_then = *env.m_non_void;
+
+    s << "\t# jumpt finish" << endl;
+    emit_branch(labelnum_finish, s);
     s << endl;
 
+    s << "# False:" << endl;
+    emit_label_def(labelnum_false, s);
+
+    *env.m_non_void = _facts_else;
+    if (_tested != nullptr && void_if_true) {
+        env.SetNonVoid(_tested, true);
+    }
+    else_exp->code(s, env.ForTail(this, else_exp));
+
+    s << "# Finish:" << endl;
+    emit_label_def(labelnum_finish, s);
+
+    *env.m_non_void = IntersectFacts(_facts_then, *env.m_non_void);
+
 }
 
-void mul_class::code(ostream& s, Environment env) {
-    s << "\t# Int operation : Mul" << endl;
-    s << "\t# First eval e1 and push." << endl;
-    e1->code(s, env);
-    emit_push(ACC, s);
-    env.AddObstacle();
+void loop_class::code(ostream& s, Environment env) {
+    int start = gen_state.labelnum;
+    int test = gen_state.labelnum + 1;
+    gen_state.labelnum += 2;
+
+    // The test is at the bottom, so each iteration takes a single branch.
+    s << "\t# While loop" << endl;
+    emit_branch(test, s);
+    s << "\t# start:" << endl;
+    emit_label_def(start, s);
+
+    // Nullness facts from before the loop may not hold on the back edge.
+    // The body is only entered when pred is true.
+    env.m_non_void->clear();
+    bool void_if_true = false;
+    Symbol _tested = GetVoidTested(pred, void_if_true);
+    if (_tested != nullptr && !void_if_true) {
+        env.SetNonVoid(_tested, true);
+    }
+    body->code(s, env);
+    env.m_non_void->clear();
+
+    s << "\t# test: if pred == true jumpto start" << endl;
+    emit_label_def(test, s);
+    emit_cond_branch(pred, true, start, env, s);
     s << endl;
 
-    s << "\t# Then eval e2 and make a copy for result." << endl;
-    e2->code(s, env);
-    emit_jal("Object.copy", s);
+    s << "\t# ACC = void" << endl;
+    emit_move(ACC, ZERO, s);
+
+}
+
+void typcase_class::code(ostream& s, Environment env) {
+    s << "\t# case expr" << endl;
+    s << "\t# First eval e0" << endl;
+    expr->code(s, env);
+
+    if (!IsNonVoid(expr, env)) {
+        s << "\t# If e0 = void, abort" << endl;
+        emit_beqz(ACC, GetAbortStub("_case_abort2", this, env), s);
+
+        if (object_class* _object = dynamic_cast<object_class*>(expr)) {
+            env.SetNonVoid(_object->name, true);
+        }
+    }
+
+    s << "\t# T1 = type(acc)" << endl;
+    emit_load(T1, 0, ACC, s);
+
+    // The dynamic type of e0 is in the subtree of its static type. Only the
+    // branches inside that subtree and the closest branch above it (which
+    // then catches everything else) can be taken.
+    Symbol _expr_type = expr->get_type();
+    if (_expr_type == SELF_TYPE) {
+        _expr_type = env.m_class_node->name;
+    }
+    CgenNode* _expr_node = codegen_classtable->GetClassNode(_expr_type);
+
+    std::vector<branch_class*> _cases = GetCases();
+    std::vector<branch_class*> _subtree_cases;
+    branch_class* _default_case = nullptr;
+    CgenNode* _default_node = nullptr;
+    for (branch_class* _case : _cases) {
+        CgenNode* _case_node = codegen_classtable->GetClassNode(_case->type_decl);
+        if (_expr_node->IsSubclassOf(_case_node)) {
+            if (_default_node == nullptr || _case_node->IsSubclassOf(_default_node)) {
+                _default_case = _case;
+                _default_node = _case_node;
+            }
+        } else if (_case_node->IsSubclassOf(_expr_node)) {
+            _subtree_cases.push_back(_case);
+        } else {
+            s << "\t# case " << _case->type_decl << " is unreachable" << endl;
+        }
+    }
+
+    // Most specific first, so that the first range holding the tag belongs
+    // to the closest ancestor of the dynamic type.
+    std::stable_sort(_subtree_cases.begin(), _subtree_cases.end(),
+        [](branch_class* a, branch_class* b) {
+            return codegen_classtable->GetClassNode(a->type_decl)->GetInheritance().size() >
+                   codegen_classtable->GetClassNode(b->type_decl)->GetInheritance().size();
+        });
+
+    int finish = gen_state.labelnum++;
+    std::vector<int> case_labels;
+    for (branch_class* _case : _subtree_cases) {
+        CgenNode* _case_node = codegen_classtable->GetClassNode(_case->type_decl);
+        int lo = _case_node->class_tag;
+        int hi = _case_node->class_tag_end;
+        int case_label = gen_state.labelnum++;
+        case_labels.push_back(case_label);
+
+        s << "\t# tag in [" << lo << ", " << hi << "] : goto case " << _case->type_decl << endl;
+        if (lo == hi) {
+            emit_beqi(T1, lo, case_label, s);
+        } else if (hi == _expr_node->class_tag_end) {
+            emit_bgei(T1, lo, case_label, s);
+        } else {
+            int next = gen_state.labelnum++;
+            emit_blti(T1, lo, next, s);
+            emit_bleqi(T1, hi, case_label, s);
+            emit_label_def(next, s);
+        }
+    }
+
+    // Nullness facts after the case are those that hold after every branch.
+    std::set<int> _facts_before = *env.m_non_void;
+    std::set<int> _facts_after;
+    bool _first_case = true;
+
+    auto code_case = [&](branch_class* _case) {
+        s << "# eval case " << _case->type_decl << endl;
+        *env.m_non_void = _facts_before;
+        env.EnterScope();
+        emit_store_slot(ACC, env.AddVar(_case->name), s);
+        env.SetNonVoid(_case->name, true);
+        _case->expr->code(s, env.ForTail(this, _case->expr));
+        env.ExitScope();
+
+        _facts_after = _first_case ? *env.m_non_void : IntersectFacts(_facts_after, *env.m_non_void);
+        _first_case = false;
+
+        s << "\t# Jumpto finish" << endl;
+        emit_branch(finish, s);
+    };
+
+    if (_default_case != nullptr) {
+        code_case(_default_case);
+    } else {
+        s << "\t# No match" << endl;
+        emit_branch(GetAbortStub("_case_abort", nullptr, env), s);
+    }
+
+    for (size_t i = 0; i < _subtree_cases.size(); ++i) {
+        emit_label_def(case_labels[i], s);
+        code_case(_subtree_cases[i]);
+    }
+
+    s << "#finish:" << endl;
+    emit_label_def(finish, s);
     s << endl;
 
-    s << "\t# Let's pop e1 to t1, move e2 to t2" << endl;
-    emit_addiu(SP, SP, 4, s);
-    emit_load(T1, 0, SP, s);
+    *env.m_non_void = _facts_after;
+}
+
+void block_class::code(ostream& s, Environment env) {
+    for (int i = body->first(); body->more(i); i = body->next(i)) {
+        Expression expr = body->nth(i);
+        if (body->more(body->next(i))) {
+            expr->code(s, env);
+        } else {
+            expr->code(s, env.ForTail(this, expr));
+        }
+    }
+}
+
+void let_class::code(ostream& s, Environment env) {
+    s << "\t# Let expr" << endl;
+    auto _owned = stack_object_owners.find(this);
+    if (_owned != stack_object_owners.end()) {
+        emit_reserve_stack_object(_owned->second, env, s);
+    }
+    s << "\t# First eval init" << endl;
+    init->code(s, env);
+
+    if (init->IsEmpty()) {
+        // We still need to deal with basic types.
+        if (type_decl == Str) {
+            emit_load_string(ACC, stringtable.lookup_string(""), s);
+        } else if (type_decl == Int) {
+            emit_load_int(ACC, inttable.lookup_string("0"), s);
+        } else if (type_decl == Bool) {
+            emit_load_bool(ACC, BoolConst(0), s);
+        }
+    }
+
+    // Decide before the new var can shadow a var of the same name in init.
+    bool non_void = init->IsEmpty() ? (type_decl == Str || type_decl == Int || type_decl == Bool)
+                                    : IsNonVoid(init, env);
+
+    env.EnterScope();
+    s << "\t# save to the variable's slot" << endl;
+    emit_store_slot(ACC, env.AddVar(identifier), s);
+    env.SetNonVoid(identifier, non_void);
+    if (_owned != stack_object_owners.end()) {
+        env.m_stack_objects.push_back(identifier);
+    }
+    s << endl;
+
+    body->code(s, env.ForTail(this, body));
+}
+
+typedef void (*IntOpEmitter)(const char* dest, const char* src1, const char* src2, ostream& s);
+
+// e1 is in slot and e2 in ACC. Puts the result of their Int operation in
+// T3.
+static void emit_int_op(IntOpEmitter emit_op, int slot, ostream& s) {
+    s << "\t# Let's load e1 to t1, move e2 to t2" << endl;
+    emit_load_slot(T1, slot, s);
     emit_move(T2, ACC, s);
     s << endl;
 
     s << "\t# Extract the int inside the object." << endl;
     emit_load(T1, 3, T1, s);
     emit_load(T2, 3, T2, s);
-    s << endl;
-
-    s << "\t# Modify the int inside t2." << endl;
-    emit_mul(T3, T1, T2, s);
-    emit_store(T3, 3, ACC, s);
+    emit_op(T3, T1, T2, s);
     s << endl;
 }
 
-void divide_class::code(ostream& s, Environment env) {
-    s << "\t# Int operation : Div" << endl;
-    s << "\t# First eval e1 and push." << endl;
+static void emit_arith(Expression e1, Expression e2, IntOpEmitter emit_op, Environment env, ostream& s) {
+    s << "\t# First eval e1 and save it." << endl;
     e1->code(s, env);
-    emit_push(ACC, s);
-    env.AddObstacle();
+    int slot = env.AddObstacle();
+    emit_store_slot(ACC, slot, s);
     s << endl;
 
-    s << "\t# Then eval e2 and make a copy for result." << endl;
+    s << "\t# Then eval e2." << endl;
     e2->code(s, env);
-    emit_jal("Object.copy", s);
-    s << endl;
-
-    s << "\t# Let's pop e1 to t1, move e2 to t2" << endl;
-    emit_addiu(SP, SP, 4, s);
-    emit_load(T1, 0, SP, s);
-    emit_move(T2, ACC, s);
     s << endl;
 
-    s << "\t# Extract the int inside the object." << endl;
-    emit_load(T1, 3, T1, s);
-    emit_load(T2, 3, T2, s);
+    emit_int_op(emit_op, slot, s);
+    int labelnum_copy = gen_state.labelnum++;
+    int labelnum_finish = gen_state.labelnum++;
+    emit_pooled_int(labelnum_copy, s);
+    emit_branch(labelnum_finish, s);
     s << endl;
 
-    s << "\t# Modify the int inside t2." << endl;
-    emit_div(T3, T1, T2, s);
+    s << "\t# Otherwise make a copy of e2 for the result." << endl;
+    emit_label_def(labelnum_copy, s);
+    emit_jal("Object.copy", s);
+    emit_int_op(emit_op, slot, s);
     emit_store(T3, 3, ACC, s);
+    emit_label_def(labelnum_finish, s);
     s << endl;
+}
+
+void plus_class::code(ostream& s, Environment env) {
+    s << "\t# Int operation : Add" << endl;
+    emit_arith(e1, e2, emit_add, env, s);
+}
+
+void sub_class::code(ostream& s, Environment env) {
+    s << "\t# Int operation : Sub" << endl;
+    emit_arith(e1, e2, emit_sub, env, s);
+}
+
+void mul_class::code(ostream& s, Environment env) {
+    s << "\t# Int operation : Mul" << endl;
+    emit_arith(e1, e2, emit_mul, env, s);
+}
 
+void divide_class::code(ostream& s, Environment env) {
+    s << "\t# Int operation : Div" << endl;
+    emit_arith(e1, e2, emit_div, env, s);
 }
 
 void neg_class::code(ostream& s, Environment env) {
     s << "\t# Neg" << endl;
-    s << "\t# Eval e1 and make a copy for result" << endl;
     e1->code(s, env);
-    emit_jal("Object.copy", s);
+    emit_load(T3, 3, ACC, s);
+    emit_neg(T3, T3, s);
+    int labelnum_copy = gen_state.labelnum++;
+    int labelnum_finish = gen_state.labelnum++;
+    emit_pooled_int(labelnum_copy, s);
+    emit_branch(labelnum_finish, s);
     s << endl;
 
+    s << "\t# Otherwise make a copy of e1 for the result" << endl;
+    emit_label_def(labelnum_copy, s);
+    emit_jal("Object.copy", s);
     emit_load(T1, 3, ACC, s);
     emit_neg(T1, T1, s);
     emit_store(T1, 3, ACC, s);
+    emit_label_def(labelnum_finish, s);
     s << endl;
-
 }
 
 void lt_class::code(ostream& s, Environment env) {
     s << "\t# Int operation : Less than" << endl;
-    s << "\t# First eval e1 and push." << endl;
+    s << "\t# First eval e1 and save it." << endl;
     e1->code(s, env);
-    emit_push(ACC, s);
-    env.AddObstacle();
+    int slot = env.AddObstacle();
+    emit_store_slot(ACC, slot, s);
     s << endl;
 
     s << "\t# Then eval e2." << endl;
     e2->code(s, env);
     s << endl;
 
-    s << "\t# Let's pop e1 to t1, move e2 to t2" << endl;
-    emit_addiu(SP, SP, 4, s);
-    emit_load(T1, 0, SP, s);
+    s << "\t# Let's load e1 to t1, move e2 to t2" << endl;
+    emit_load_slot(T1, slot, s);
     emit_move(T2, ACC, s);
     s << endl;
 
@@ -1794,64 +3821,51 @@ void lt_class::code(ostream& s, Environment env) {
     s << "\t# Pretend that t1 < t2" << endl;
     emit_load_bool(ACC, BoolConst(1), s);
     s << "\t# If t1 < t2 jumpto finish" << endl;
-    emit_blt(T1, T2, labelnum, s);
+    emit_blt(T1, T2, gen_state.labelnum, s);
 
     emit_load_bool(ACC, BoolConst(0), s);
-    emit_label_def(labelnum, s);
+    emit_label_def(gen_state.labelnum, s);
 
-    ++labelnum;
+    ++gen_state.labelnum;
 }
 
 void eq_class::code(ostream& s, Environment env) {
     s << "\t# equal" << endl;
-    s << "\t# First eval e1 and push." << endl;
-    e1->code(s, env);
-    emit_push(ACC, s);
-    env.AddObstacle();
-    s << endl;
-
-    s << "\t# Then eval e2." << endl;
-    e2->code(s, env);
-    s << endl;
-
-    s << "\t# Let's pop e1 to t1, move e2 to t2" << endl;
-    emit_addiu(SP, SP, 4, s);
-    emit_load(T1, 0, SP, s);
-    emit_move(T2, ACC, s);
-    s << endl;
-
-    if (e1->type == Int || e1->type == Str || e1->type == Bool)
-        if (e2->type == Int || e2->type == Str || e2->type == Bool) {
-            emit_load_bool(ACC, BoolConst(1), s);
-            emit_load_bool(A1, BoolConst(0), s);
-            emit_jal("equality_test", s);
-            return;
-        }
+    EqKind kind = GetEqKind(this);
+    emit_eq_operands(this, env, s);
 
     s << "\t# Pretend that t1 = t2" << endl;
     emit_load_bool(ACC, BoolConst(1), s);
-    s << "\t# Compare the two pointers." << endl;
-    emit_beq(T1, T2, labelnum, s);
-    emit_load_bool(ACC, BoolConst(0), s);
-    emit_label_def(labelnum, s);
-    ++labelnum;
+    if (kind == EQ_VALUE) {
+        s << "\t# Compare the two values." << endl;
+    } else {
+        s << "\t# Compare the two pointers." << endl;
+    }
+    emit_beq(T1, T2, gen_state.labelnum, s);
+    if (kind == EQ_RUNTIME) {
+        emit_load_bool(A1, BoolConst(0), s);
+        emit_jal("equality_test", s);
+    } else {
+        emit_load_bool(ACC, BoolConst(0), s);
+    }
+    emit_label_def(gen_state.labelnum, s);
+    ++gen_state.labelnum;
 }
 
 void leq_class::code(ostream& s, Environment env) {
     s << "\t# Int operation : Less or equal" << endl;
-    s << "\t# First eval e1 and push." << endl;
+    s << "\t# First eval e1 and save it." << endl;
     e1->code(s, env);
-    emit_push(ACC, s);
-    env.AddObstacle();
+    int slot = env.AddObstacle();
+    emit_store_slot(ACC, slot, s);
     s << endl;
 
     s << "\t# Then eval e2." << endl;
     e2->code(s, env);
     s << endl;
 
-    s << "\t# Let's pop e1 to t1, move e2 to t2" << endl;
-    emit_addiu(SP, SP, 4, s);
-    emit_load(T1, 0, SP, s);
+    s << "\t# Let's load e1 to t1, move e2 to t2" << endl;
+    emit_load_slot(T1, slot, s);
     emit_move(T2, ACC, s);
     s << endl;
 
@@ -1863,12 +3877,12 @@ void leq_class::code(ostream& s, Environment env) {
     s << "\t# Pretend that t1 < t2" << endl;
     emit_load_bool(ACC, BoolConst(1), s);
     s << "\t# If t1 < t2 jumpto finish" << endl;
-    emit_bleq(T1, T2, labelnum, s);
+    emit_bleq(T1, T2, gen_state.labelnum, s);
 
     emit_load_bool(ACC, BoolConst(0), s);
-    emit_label_def(labelnum, s);
+    emit_label_def(gen_state.labelnum, s);
 
-    ++labelnum;
+    ++gen_state.labelnum;
 }
 
 void comp_class::code(ostream& s, Environment env) {
@@ -1883,15 +3897,15 @@ void comp_class::code(ostream& s, Environment env) {
     emit_load_bool(ACC, BoolConst(1), s);
 
     s << "\t# If ACC = false, jumpto finish" << endl;
-    emit_beq(T1, ZERO, labelnum, s);
+    emit_beq(T1, ZERO, gen_state.labelnum, s);
 
     s << "\t# Load false" << endl;
     emit_load_bool(ACC, BoolConst(0), s);
 
     s << "\t# finish:" << endl;
-    emit_label_def(labelnum, s);
+    emit_label_def(gen_state.labelnum, s);
 
-    ++labelnum;
+    ++gen_state.labelnum;
 
 }
 
@@ -1910,8 +3924,60 @@ void bool_const_class::code(ostream& s, Environment env) {
     emit_load_bool(ACC, BoolConst(val), s);
 }
 
+// Allocates an object of class type_name in the frame, in the slots
+// reserved from first_slot on (see emit_reserve_stack_object). Slots go
+// down the stack, so the eyecatcher is in the last and field i in the
+// one before the last but i. No collection is needed, and the collector
+// updates the fields like any other words of the stack.
+static void emit_stack_new(Symbol type_name, int first_slot, ostream& s) {
+    CgenNode* _class_node = codegen_classtable->GetClassNode(type_name);
+    int words = DEFAULT_OBJFIELDS + _class_node->GetFullAttribs().size();
+
+    s << "\t# Allocate " << type_name << " in the frame" << endl;
+    emit_addiu(ACC, FP, -WORD_SIZE * (first_slot + words), s);
+    emit_load_imm(T1, -1, s);
+    emit_store(T1, -1, ACC, s);
+    emit_load_address(T1, _class_node->m_protobj_label.c_str(), s);
+    for (int i = 0; i < words; ++i) {
+        emit_load(T2, i, T1, s);
+        emit_store(T2, i, ACC, s);
+    }
+    s << endl;
+
+    if (IsTrivialInit(_class_node)) {
+        s << "\t# No init: the protObj is already initialized." << endl;
+    } else {
+        emit_jal(_class_node->m_init_label.c_str(), s);
+    }
+    s << endl;
+}
+
 void new__class::code(ostream& s, Environment env) {
+    if (cgen_profile) {
+        std::ostringstream name;
+        name << env.m_class_node->get_filename() << ":" << get_line_number() << ": new " << type_name;
+        int tag = type_name == SELF_TYPE ? -1 : codegen_classtable->GetClassNode(type_name)->class_tag;
+        emit_profile_count(profile_method_num + gen_state.profile_sites.size(), s);
+        gen_state.profile_sites.push_back(ProfileSite { name.str(), PROFILE_NEW, tag });
+    }
+
+    auto _slot = stack_object_slots.find(this);
+    if (_slot != stack_object_slots.end()) {
+        emit_stack_new(type_name, _slot->second, s);
+        stack_object_slots.erase(_slot);
+        return;
+    }
+
     if (type_name == SELF_TYPE) {
+        // Self is an instance of the class or of one of its subclasses,
+        // whose tags follow it.
+        bool trivial = IsTrivialInit(env.m_class_node);
+        std::vector<CgenNode*> _class_nodes = codegen_classtable->GetClassNodes();
+        for (int tag = env.m_class_node->class_tag + 1;
+             trivial && tag <= env.m_class_node->class_tag_end; ++tag) {
+            trivial = !InitsOwnAttribs(_class_nodes[tag]);
+        }
+
         emit_load_address(T1, "class_objTab", s);
 
         s << "\t# Find class tag." << endl;
@@ -1924,8 +3990,19 @@ void new__class::code(ostream& s, Environment env) {
 
         emit_addu(T1, T1, T2, s);
 
-        s << "\t# Push." << endl;
-        emit_push(T1, s);
+        if (trivial) {
+            s << "\t# Load protObj to ACC." << endl;
+            emit_load(ACC, 0, T1, s);
+            s << endl;
+
+            emit_jal("Object.copy", s);
+            s << "\t# No init: the protObj of every subclass is already initialized." << endl;
+            return;
+        }
+
+        s << "\t# Save." << endl;
+        int slot = env.AddObstacle();
+        emit_store_slot(T1, slot, s);
         s << endl;
 
         s << "\t# Load protObj to ACC." << endl;
@@ -1934,9 +4011,8 @@ void new__class::code(ostream& s, Environment env) {
 
         emit_jal("Object.copy", s);
 
-        s << "\t# Pop protObj addr." << endl;
-        emit_load(T1, 1, SP, s);
-        emit_addiu(SP, SP, 4, s);
+        s << "\t# Restore protObj addr." << endl;
+        emit_load_slot(T1, slot, s);
         s << endl;
 
         s << "\t# Get init addr." << endl;
@@ -1950,13 +4026,53 @@ void new__class::code(ostream& s, Environment env) {
         return;
     }
 
-    std::string dest = type_name->get_string();
-    dest += PROTOBJ_SUFFIX;
-    emit_load_address(ACC, dest.c_str(), s);
-    emit_jal("Object.copy", s);
-    dest = type_name->get_string();
-    dest += CLASSINIT_SUFFIX;
-    emit_jal(dest.c_str(), s);
+    // The class is known, so its size is too: allocate and copy the
+    // protObj inline instead of calling Object.copy.
+    CgenNode* _class_node = codegen_classtable->GetClassNode(type_name);
+    int words = DEFAULT_OBJFIELDS + _class_node->GetFullAttribs().size();
+    int bytes = (words + 1) * WORD_SIZE;
+    int labelnum_slow = gen_state.labelnum++;
+    int labelnum_copy = gen_state.labelnum++;
+
+    s << "\t# Allocate " << type_name << ": " << words << " words and the eyecatcher" << endl;
+    if (cgen_Memmgr_Test == GC_TEST) {
+        // Object.copy would let the collector run here.
+        emit_jal("_MemMgr_Test", s);
+    }
+    emit_addiu(GP, GP, bytes, s);
+    emit_bge(GP, LIMIT, labelnum_slow, s);
+    emit_addiu(ACC, GP, -bytes, s);
+    emit_label_def(labelnum_copy, s);
+    s << endl;
+
+    s << "\t# Copy the protObj" << endl;
+    emit_load_imm(T1, -1, s);
+    emit_store(T1, 0, ACC, s);
+    emit_addiu(ACC, ACC, WORD_SIZE, s);
+    emit_load_address(T1, _class_node->m_protobj_label.c_str(), s);
+    for (int i = 0; i < words; ++i) {
+        emit_load(T2, i, T1, s);
+        emit_store(T2, i, ACC, s);
+    }
+    s << endl;
+
+    if (IsTrivialInit(_class_node)) {
+        s << "\t# No init: the protObj is already initialized." << endl;
+    } else {
+        emit_jal(_class_node->m_init_label.c_str(), s);
+    }
+
+    // Out of line: the allocation does not fit below the limit, so undo
+    // it and let the memory manager collect or grow the heap.
+    int labelnum_finish = gen_state.labelnum++;
+    emit_branch(labelnum_finish, s);
+    emit_label_def(labelnum_slow, s);
+    emit_addiu(GP, GP, -bytes, s);
+    emit_load_imm(ACC, bytes, s);
+    emit_jal("_MemMgr_Alloc", s);
+    emit_branch(labelnum_copy, s);
+    emit_label_def(labelnum_finish, s);
+    s << endl;
 }
 
 void isvoid_class::code(ostream& s, Environment env) {
@@ -1969,16 +4085,16 @@ void isvoid_class::code(ostream& s, Environment env) {
     emit_load_bool(ACC, BoolConst(1), s);
 
     s << "\t# if t1 = void: jumpto finish" << endl;
-    emit_beq(T1, ZERO, labelnum, s);
+    emit_beq(T1, ZERO, gen_state.labelnum, s);
     s << endl;
 
     s << "\t# acc != void" << endl;
     emit_load_bool(ACC, BoolConst(0), s);
 
     s << "# finish:" << endl;
-    emit_label_def(labelnum, s);
+    emit_label_def(gen_state.labelnum, s);
 
-    ++labelnum;
+    ++gen_state.labelnum;
 }
 
 void no_expr_class::code(ostream& s, Environment env) {
@@ -1991,25 +4107,17 @@ void object_class::code(ostream& s, Environment env) {
 
     if ((idx = env.LookUpVar(name)) != -1) {
         s << "\t# It is a let variable." << endl;
-        emit_load(ACC, idx + 1, SP, s);
-        if (cgen_Memmgr == 1) {
-            emit_addiu(A1, SP, 4 * (idx + 1), s);
-            emit_jal("_GenGC_Assign", s);
-        }
+        emit_load_slot(ACC, idx, s);
     } else if ((idx = env.LookUpParam(name)) != -1) {
         s << "\t# It is a param." << endl;
-        emit_load(ACC, idx + 3, FP, s);
-        if (cgen_Memmgr == 1) {
-            emit_addiu(A1, FP, 4 * (idx + 3), s);
-            emit_jal("_GenGC_Assign", s);
+        if (const char* reg = env.LookUpParamReg(idx)) {
+            emit_move(ACC, reg, s);
+        } else {
+            emit_load(ACC, idx + 3, FP, s);
         }
     } else if ((idx = env.LookUpAttrib(name)) != -1) {
         s << "\t# It is an attribute." << endl;
         emit_load(ACC, idx + 3, SELF, s);
-        if (cgen_Memmgr == 1) {
-            emit_addiu(A1, SELF, 4 * (idx + 3), s);
-            emit_jal("_GenGC_Assign", s);
-        }
     } else if (name == self) {
         s << "\t# It is self." << endl;
         emit_move(ACC, SELF, s);
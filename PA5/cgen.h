@@ -3,6 +3,7 @@
 #include <stack>
 #include <vector>
 #include <list>
+#include <set>
 #include "emit.h"
 #include "cool-tree.h"
 #include "symtab.h"
@@ -22,6 +23,9 @@ typedef CgenClassTable *CgenClassTableP;
 class CgenNode;
 typedef CgenNode *CgenNodeP;
 
+class BcEmitter;
+struct BcProgram;
+
 class CgenClassTable : public SymbolTable<Symbol,CgenNode> {
 private:
     List<CgenNode> *nds;
@@ -40,12 +44,21 @@ private:
     void code_bools(int);
     void code_select_gc();
     void code_constants();
+    void code_int_pool();
     void code_class_nameTab();
     void code_class_objTab();
     void code_dispatchTabs();
     void code_protObjs();
-    void code_class_inits();
-    void code_class_methods();
+    void code_class_text();
+    void code_abort_stubs();
+    void code_buffered_io();
+    void code_regargs_adapters();
+    void code_profile_tables();
+// The x86-64 backend (cgen_x86.cc).
+    void code_x86_global_data();
+    void code_x86_class_tables();
+    void code_x86_constants();
+    void code_x86_text();
 // The following creates an inheritance graph from
 // a list of classes.  The graph is implemented as
 // a tree of `CgenNode', and class names are placed
@@ -56,6 +69,8 @@ private:
     void install_classes(Classes cs);
     void build_inheritance_tree();
     void set_relations(CgenNodeP nd);
+    void AssignClassTags(CgenNode* class_node);
+    void AnalyzeEscapes();
 public:
     CgenClassTable(Classes, ostream& str);
     void Execute() {
@@ -63,16 +78,32 @@ public:
         exitscope();
     }
     void code();
+    void code_x86();
+    void code_bytecode(BcProgram& program);
     CgenNodeP root();
     std::vector<CgenNode*> GetClassNodes();
     std::map<Symbol, int> GetClassTags();
     CgenNode* GetClassNode(Symbol class_name) {
-        GetClassNodes();
-        return m_class_nodes[m_class_tags[class_name]];
+        if (m_class_nodes.empty()) {
+            AssignClassTags(root());
+        }
+        return m_class_nodes[m_class_tags.find(class_name)->second];
     }
 };
 
 
+// What a counter of -P counts: the calls of a method, the objects
+// allocated by a new, or the calls at a dispatch with a receiver of one
+// class. The values are those of _prof_kinds.
+enum ProfileKind { PROFILE_CALL, PROFILE_NEW, PROFILE_RECEIVER };
+
+struct ProfileSite {
+    std::string name;
+    ProfileKind kind;
+    int tag;                // of the class allocated or received, -1 if
+                            // not known
+};
+
 class CgenNode : public class__class {
 private:
     CgenNodeP parentnd;                        // Parent of class
@@ -114,6 +145,9 @@ public:
     void code_protObj(ostream& s);
     void code_init(ostream& s);
     void code_methods(ostream& s);
+    void code_protObj_x86(ostream& s);
+    void code_init_x86(ostream& s);
+    void code_init_bc(BcEmitter& e);
 
     std::vector<method_class*> GetMethods();
     std::vector<method_class*> m_methods;
@@ -139,9 +173,32 @@ public:
     std::vector<CgenNode*> GetInheritance();
     std::vector<CgenNode*> inheritance;
 
+    // Tags are assigned in DFS preorder, so this class and all of its
+    // descendants have exactly the tags in [class_tag, class_tag_end].
     int class_tag;
+    int class_tag_end;
+
+    bool IsSubclassOf(CgenNode* class_node) {
+        return class_node->class_tag <= class_tag && class_tag <= class_node->class_tag_end;
+    }
+
+    // Labels rendered once, before any code is generated, so that the
+    // generator threads only read them.
+    void RenderLabels();
+    std::string m_protobj_label;
+    std::string m_init_label;
+    std::map<Symbol, std::string> m_method_labels;  // own methods
+    std::map<Symbol, std::string> m_callee_labels;  // what callers jump to
+
+    // With -P, the counters of the class are its methods' followed by
+    // those of its allocation and dispatch sites.
+    std::vector<ProfileSite> m_profile_sites;
 };
 
+// True if the init of class_node, including those of its ancestors,
+// leaves every attribute with its default value (cgen.cc).
+bool IsTrivialInit(CgenNode* class_node);
+
 class BoolConst
 {
 private:
@@ -155,7 +212,8 @@ public:
 
 class Environment {
 public:
-    Environment() : m_class_node(nullptr) {}
+    Environment() : m_class_node(nullptr), m_max_slots(nullptr), m_tail_expr(nullptr),
+        m_non_void(nullptr), m_reg_param_num(0), m_params_in_regs(false) {}
 
     void EnterScope() {
         m_scope_lengths.push_back(0);
@@ -176,20 +234,28 @@ public:
         return -1;
     }
 
-    // The vars are in reverse order.
+    // A var's index is its slot in the frame.
     int LookUpVar(Symbol sym) {
         for (int idx = m_var_idx_tab.size() - 1; idx >= 0; --idx) {
             if (m_var_idx_tab[idx] == sym) {
-                return m_var_idx_tab.size() - 1 - idx;
+                return idx;
             }
         }
         return -1;
     }
 
     int AddVar(Symbol sym) {
+        if (m_non_void != nullptr) {
+            // The slot may be reused from a var that has gone out of scope.
+            m_non_void->erase(m_var_idx_tab.size());
+        }
         m_var_idx_tab.push_back(sym);
         ++m_scope_lengths[m_scope_lengths.size() - 1];
-        return m_var_idx_tab.size() - 1;
+        int slot_num = m_var_idx_tab.size();
+        if (m_max_slots != nullptr && *m_max_slots < slot_num) {
+            *m_max_slots = slot_num;
+        }
+        return slot_num - 1;
     }
 
     int AddObstacle();
@@ -208,9 +274,85 @@ public:
         return m_param_idx_tab.size() - 1;
     }
 
+    // The register holding the param of index idx, or nullptr if it is on
+    // the stack.
+    const char* LookUpParamReg(int idx) {
+        int formal = m_param_idx_tab.size() - 1 - idx;
+        if (!m_params_in_regs || formal >= m_reg_param_num) {
+            return nullptr;
+        }
+        static const char* const regs[] = { A1, A2, A3 };
+        return regs[formal];
+    }
+
     std::vector<int> m_scope_lengths;
     std::vector<Symbol> m_var_idx_tab;
     std::vector<Symbol> m_param_idx_tab;
     CgenNode* m_class_node;
 
+    // Number of slots the frame being generated needs, shared by all the
+    // copies of the environment made while generating one method.
+    int* m_max_slots;
+
+    // The expression whose value is returned by the method being generated,
+    // if it is a dispatch it can be compiled as a tail call.
+    Expression m_tail_expr;
+
+    // Nullness facts: keys (see GetNonVoidKey) of the vars and params known
+    // not to be void at the point being generated. Shared by all copies of
+    // the environment made while generating one method.
+    std::set<int>* m_non_void;
+
+    // Vars are keyed by slot and params by -1 - index. Attributes may be
+    // changed by any call, so they have no key.
+    int GetNonVoidKey(Symbol sym) {
+        int idx;
+        if ((idx = LookUpVar(sym)) != -1) {
+            return idx;
+        }
+        if ((idx = LookUpParam(sym)) != -1) {
+            return -1 - idx;
+        }
+        return NO_NON_VOID_KEY;
+    }
+
+    bool IsKnownNonVoid(Symbol sym) {
+        int key = GetNonVoidKey(sym);
+        return m_non_void != nullptr && key != NO_NON_VOID_KEY && m_non_void->count(key) != 0;
+    }
+
+    void SetNonVoid(Symbol sym, bool non_void) {
+        int key = GetNonVoidKey(sym);
+        if (m_non_void == nullptr || key == NO_NON_VOID_KEY) {
+            return;
+        }
+        if (non_void) {
+            m_non_void->insert(key);
+        } else {
+            m_non_void->erase(key);
+        }
+    }
+
+    static const int NO_NON_VOID_KEY = -1000000;
+
+    // With register arguments (-a) the first m_reg_param_num formals are
+    // passed in $a1-$a3. A leaf keeps them there (m_params_in_regs);
+    // otherwise the prologue stores formal i to slot i, where it is a var.
+    int m_reg_param_num;
+    bool m_params_in_regs;
+
+    // Let vars that may hold an object allocated in the frame, which calls
+    // on them must not pop (see MayBeInFrame).
+    std::vector<Symbol> m_stack_objects;
+
+    // The environment for child, whose value is the value of parent: child
+    // is in tail position if parent is.
+    Environment ForTail(Expression parent, Expression child) {
+        Environment ret = *this;
+        if (ret.m_tail_expr == parent) {
+            ret.m_tail_expr = child;
+        }
+        return ret;
+    }
+
 };
\ No newline at end of file
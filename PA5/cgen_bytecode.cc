@@ -0,0 +1,494 @@
+//**************************************************************
+//
+// Bytecode generator, selected by -b (see bytecode.h).
+//
+// Each method is compiled for an accumulator machine: every expression
+// leaves its value in the accumulator, and the first operand of a
+// binary operation, like the actuals of a call, is pushed on the
+// stack. A method's locals are its params, first to last, followed by
+// its let vars and case branches, numbered as the slots of the MIPS
+// frame.
+//
+//**************************************************************
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <map>
+#include <tuple>
+#include <cstring>
+#include <cstdlib>
+
+#include "cgen.h"
+#include "bytecode.h"
+
+extern CgenClassTable* codegen_classtable;
+
+extern Symbol
+    Bool,
+    Int,
+    IO,
+    Object,
+    SELF_TYPE,
+    self,
+    Str;
+
+//
+// What code_bc appends to: the program and the method being generated.
+//
+class BcEmitter {
+public:
+    BcEmitter(BcProgram& program) : m_program(program) {}
+
+    void Emit(BcOp op) {
+        m_program.code.push_back(op);
+        switch (op) {
+        case BC_PUSH:
+            m_max_push_num = std::max(m_max_push_num, ++m_push_num);
+            break;
+        case BC_ADD:
+        case BC_SUB:
+        case BC_MUL:
+        case BC_DIV:
+        case BC_LT:
+        case BC_LEQ:
+        case BC_EQ:
+            --m_push_num;
+            break;
+        default:
+            break;
+        }
+    }
+
+    void Emit(BcOp op, int a) {
+        Emit(op);
+        m_program.code.push_back(a);
+    }
+
+    void Emit(BcOp op, int a, int b, int c) {
+        Emit(op, a);
+        m_program.code.push_back(b);
+        m_program.code.push_back(c);
+        if (op == BC_DISPATCH || op == BC_CALL) {
+            m_push_num -= b;
+        }
+    }
+
+    // Emits op with its target last, and returns where the target goes so
+    // that it can be patched once known.
+    int EmitJump(BcOp op) {
+        Emit(op, -1);
+        return m_program.code.size() - 1;
+    }
+
+    void PatchHere(int target) {
+        m_program.code[target] = Here();
+    }
+
+    int Here() {
+        return m_program.code.size();
+    }
+
+    int Const(BcConst::Kind kind, int val, const std::string& str) {
+        auto key = std::make_tuple(kind, val, str);
+        auto iter = m_const_idx.find(key);
+        if (iter != m_const_idx.end()) {
+            return iter->second;
+        }
+        BcConst c = { kind, val, str };
+        m_program.consts.push_back(c);
+        m_const_idx[key] = m_program.consts.size() - 1;
+        return m_program.consts.size() - 1;
+    }
+
+    int IntConst(int val) {
+        return Const(BcConst::INT, val, "");
+    }
+
+    int BoolConst(bool val) {
+        return Const(BcConst::BOOL, val, "");
+    }
+
+    int StringConst(const std::string& str) {
+        return Const(BcConst::STRING, 0, str);
+    }
+
+    // The default value of a var or attribute of type, or -1 for void.
+    int DefaultConst(Symbol type) {
+        if (type == Int) {
+            return IntConst(0);
+        }
+        if (type == Bool) {
+            return BoolConst(false);
+        }
+        if (type == Str) {
+            return StringConst("");
+        }
+        return -1;
+    }
+
+    void EmitDefault(Symbol type) {
+        int c = DefaultConst(type);
+        if (c == -1) {
+            Emit(BC_LOAD_VOID);
+        } else {
+            Emit(BC_LOAD_CONST, c);
+        }
+    }
+
+    // Locals: the params of the method, then its slots.
+    int ParamLocal(Environment& env, int idx) {
+        return env.m_param_idx_tab.size() - 1 - idx;
+    }
+
+    int SlotLocal(Environment& env, int slot) {
+        return env.m_param_idx_tab.size() + slot;
+    }
+
+    // The methods of each class, by tag, are numbered before any code is
+    // generated so that calls can refer to those not generated yet.
+    std::vector<std::map<Symbol, int>> m_method_ids;
+    std::vector<int> m_init_ids;
+
+    int MethodId(Symbol class_name, Symbol method_name) {
+        return m_method_ids[codegen_classtable->GetClassNode(class_name)->class_tag][method_name];
+    }
+
+    BcProgram& m_program;
+
+    // The values the method being generated has on the stack, and the most
+    // it has had, which the VM makes room for when it is called.
+    int m_push_num = 0;
+    int m_max_push_num = 0;
+
+private:
+    std::map<std::tuple<int, int, std::string>, int> m_const_idx;
+};
+
+static BcNative GetNative(Symbol class_name, Symbol method_name) {
+    static const struct {
+        const char* class_name;
+        const char* method_name;
+        BcNative native;
+    } natives[] = {
+        { "Object", "abort", BC_OBJECT_ABORT },
+        { "Object", "type_name", BC_OBJECT_TYPE_NAME },
+        { "Object", "copy", BC_OBJECT_COPY },
+        { "IO", "out_string", BC_IO_OUT_STRING },
+        { "IO", "out_int", BC_IO_OUT_INT },
+        { "IO", "in_string", BC_IO_IN_STRING },
+        { "IO", "in_int", BC_IO_IN_INT },
+        { "String", "length", BC_STRING_LENGTH },
+        { "String", "concat", BC_STRING_CONCAT },
+        { "String", "substr", BC_STRING_SUBSTR },
+    };
+    for (const auto& native : natives) {
+        if (strcmp(class_name->get_string(), native.class_name) == 0 &&
+            strcmp(method_name->get_string(), native.method_name) == 0) {
+            return native.native;
+        }
+    }
+    return BC_NOT_NATIVE;
+}
+
+void CgenClassTable::code_bytecode(BcProgram& program) {
+    BcEmitter emitter(program);
+    std::vector<CgenNode*> class_nodes = GetClassNodes();
+
+    for (CgenNode* class_node : class_nodes) {
+        int filename = emitter.StringConst(class_node->get_filename()->get_string());
+
+        emitter.m_init_ids.push_back(-1);
+        if (!IsTrivialInit(class_node)) {
+            BcMethod init = { std::string(class_node->name->get_string()) + CLASSINIT_SUFFIX,
+                              0, 0, 0, -1, BC_NOT_NATIVE, filename };
+            emitter.m_init_ids.back() = program.methods.size();
+            program.methods.push_back(init);
+        }
+
+        emitter.m_method_ids.push_back(std::map<Symbol, int>());
+        for (method_class* method : class_node->GetMethods()) {
+            BcMethod bc_method = { std::string(class_node->name->get_string()) + METHOD_SEP +
+                                   method->name->get_string(),
+                                   method->GetArgNum(), 0, 0, -1,
+                                   GetNative(class_node->name, method->name), filename };
+            emitter.m_method_ids.back()[method->name] = program.methods.size();
+            program.methods.push_back(bc_method);
+        }
+    }
+
+    for (CgenNode* class_node : class_nodes) {
+        BcClass bc_class;
+        bc_class.name = class_node->name->get_string();
+        bc_class.name_const = emitter.StringConst(bc_class.name);
+        bc_class.init = emitter.m_init_ids[class_node->class_tag];
+
+        std::map<Symbol, Symbol> dispatch_class_tab = class_node->GetDispatchClassTab();
+        for (method_class* method : class_node->GetFullMethods()) {
+            bc_class.disp.push_back(emitter.MethodId(dispatch_class_tab[method->name], method->name));
+        }
+        for (attr_class* attrib : class_node->GetFullAttribs()) {
+            bc_class.attrs.push_back(emitter.DefaultConst(attrib->type_decl));
+        }
+        program.classes.push_back(bc_class);
+
+        if (bc_class.init != -1) {
+            class_node->code_init_bc(emitter);
+        }
+        for (method_class* method : class_node->GetMethods()) {
+            if (!class_node->basic()) {
+                method->code_bc(emitter, class_node);
+            }
+        }
+    }
+
+    program.int_tag = intclasstag;
+    program.bool_tag = boolclasstag;
+    program.string_tag = stringclasstag;
+    program.main_class = GetClassNode(idtable.lookup_string(MAINNAME))->class_tag;
+    program.main_method = emitter.MethodId(idtable.lookup_string(MAINNAME), idtable.lookup_string("main"));
+}
+
+void CgenNode::code_init_bc(BcEmitter& e) {
+    BcMethod& init = e.m_program.methods[e.m_init_ids[class_tag]];
+    init.entry = e.Here();
+    e.m_max_push_num = 0;
+
+    int slots = 0;
+    Environment env;
+    env.m_class_node = this;
+    env.m_max_slots = &slots;
+
+    CgenNode* parent = get_parentnd();
+    if (e.m_init_ids[parent->class_tag] != -1) {
+        e.Emit(BC_LOAD_SELF);
+        e.Emit(BC_CALL, e.m_init_ids[parent->class_tag], 0, 0);
+    }
+    for (attr_class* attrib : GetAttribs()) {
+        if (!attrib->init->IsEmpty()) {
+            attrib->init->code_bc(e, env);
+            e.Emit(BC_STORE_ATTR, env.LookUpAttrib(attrib->name));
+        }
+    }
+    e.Emit(BC_LOAD_SELF);
+    e.Emit(BC_RETURN);
+    init.slot_num = slots;
+    init.push_num = e.m_max_push_num;
+}
+
+void method_class::code_bc(BcEmitter& e, CgenNode* class_node) {
+    BcMethod& method = e.m_program.methods[e.m_method_ids[class_node->class_tag][name]];
+    method.entry = e.Here();
+    e.m_max_push_num = 0;
+
+    int slots = 0;
+    Environment env;
+    env.m_class_node = class_node;
+    env.m_max_slots = &slots;
+    for (int i = formals->first(); formals->more(i); i = formals->next(i)) {
+        env.AddParam(formals->nth(i)->GetName());
+    }
+    expr->code_bc(e, env);
+    e.Emit(BC_RETURN);
+    method.slot_num = slots;
+    method.push_num = e.m_max_push_num;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Expressions
+//
+//////////////////////////////////////////////////////////////////////////////
+
+void assign_class::code_bc(BcEmitter& e, Environment env) {
+    expr->code_bc(e, env);
+
+    int idx;
+    if ((idx = env.LookUpVar(name)) != -1) {
+        e.Emit(BC_STORE_LOCAL, e.SlotLocal(env, idx));
+    } else if ((idx = env.LookUpParam(name)) != -1) {
+        e.Emit(BC_STORE_LOCAL, e.ParamLocal(env, idx));
+    } else if ((idx = env.LookUpAttrib(name)) != -1) {
+        e.Emit(BC_STORE_ATTR, idx);
+    }
+}
+
+static void code_actuals_bc(Expressions actual, BcEmitter& e, Environment& env) {
+    for (int i = actual->first(); actual->more(i); i = actual->next(i)) {
+        actual->nth(i)->code_bc(e, env);
+        e.Emit(BC_PUSH);
+    }
+}
+
+void static_dispatch_class::code_bc(BcEmitter& e, Environment env) {
+    code_actuals_bc(actual, e, env);
+    expr->code_bc(e, env);
+    CgenNode* class_node = codegen_classtable->GetClassNode(type_name);
+    Symbol impl_class = class_node->GetDispatchClassTab()[name];
+    e.Emit(BC_CALL, e.MethodId(impl_class, name), actual->len(), get_line_number());
+}
+
+void dispatch_class::code_bc(BcEmitter& e, Environment env) {
+    code_actuals_bc(actual, e, env);
+    expr->code_bc(e, env);
+    Symbol type = expr->get_type();
+    CgenNode* class_node = type == SELF_TYPE ? env.m_class_node : codegen_classtable->GetClassNode(type);
+    e.Emit(BC_DISPATCH, class_node->GetDispatchIdxTab()[name], actual->len(), get_line_number());
+}
+
+void cond_class::code_bc(BcEmitter& e, Environment env) {
+    pred->code_bc(e, env);
+    int to_else = e.EmitJump(BC_JUMP_FALSE);
+    then_exp->code_bc(e, env);
+    int to_finish = e.EmitJump(BC_JUMP);
+    e.PatchHere(to_else);
+    else_exp->code_bc(e, env);
+    e.PatchHere(to_finish);
+}
+
+void loop_class::code_bc(BcEmitter& e, Environment env) {
+    int start = e.Here();
+    pred->code_bc(e, env);
+    int to_finish = e.EmitJump(BC_JUMP_FALSE);
+    body->code_bc(e, env);
+    e.Emit(BC_JUMP, start);
+    e.PatchHere(to_finish);
+    e.Emit(BC_LOAD_VOID);
+}
+
+void typcase_class::code_bc(BcEmitter& e, Environment env) {
+    expr->code_bc(e, env);
+    e.Emit(BC_CASE_VOID, get_line_number());
+
+    // Most specific first, so that the first range holding the tag belongs
+    // to the closest ancestor of the dynamic type.
+    std::vector<branch_class*> cases = GetCases();
+    std::stable_sort(cases.begin(), cases.end(),
+        [](branch_class* a, branch_class* b) {
+            return codegen_classtable->GetClassNode(a->type_decl)->GetInheritance().size() >
+                   codegen_classtable->GetClassNode(b->type_decl)->GetInheritance().size();
+        });
+
+    std::vector<int> to_finish;
+    for (branch_class* branch : cases) {
+        CgenNode* case_node = codegen_classtable->GetClassNode(branch->type_decl);
+        e.Emit(BC_JUMP_TAG_OUT, case_node->class_tag, case_node->class_tag_end, -1);
+        int to_next = e.Here() - 1;
+
+        Environment case_env = env;
+        case_env.EnterScope();
+        e.Emit(BC_STORE_LOCAL, e.SlotLocal(case_env, case_env.AddVar(branch->name)));
+        branch->expr->code_bc(e, case_env);
+        to_finish.push_back(e.EmitJump(BC_JUMP));
+        e.PatchHere(to_next);
+    }
+    e.Emit(BC_CASE_ABORT);
+    for (int target : to_finish) {
+        e.PatchHere(target);
+    }
+}
+
+void block_class::code_bc(BcEmitter& e, Environment env) {
+    for (int i = body->first(); body->more(i); i = body->next(i)) {
+        body->nth(i)->code_bc(e, env);
+    }
+}
+
+void let_class::code_bc(BcEmitter& e, Environment env) {
+    if (init->IsEmpty()) {
+        e.EmitDefault(type_decl);
+    } else {
+        init->code_bc(e, env);
+    }
+
+    env.EnterScope();
+    e.Emit(BC_STORE_LOCAL, e.SlotLocal(env, env.AddVar(identifier)));
+    body->code_bc(e, env);
+}
+
+static void code_binary_bc(Expression e1, Expression e2, BcOp op, BcEmitter& e, Environment& env) {
+    e1->code_bc(e, env);
+    e.Emit(BC_PUSH);
+    e2->code_bc(e, env);
+    e.Emit(op);
+}
+
+void plus_class::code_bc(BcEmitter& e, Environment env) {
+    code_binary_bc(e1, e2, BC_ADD, e, env);
+}
+
+void sub_class::code_bc(BcEmitter& e, Environment env) {
+    code_binary_bc(e1, e2, BC_SUB, e, env);
+}
+
+void mul_class::code_bc(BcEmitter& e, Environment env) {
+    code_binary_bc(e1, e2, BC_MUL, e, env);
+}
+
+void divide_class::code_bc(BcEmitter& e, Environment env) {
+    code_binary_bc(e1, e2, BC_DIV, e, env);
+}
+
+void neg_class::code_bc(BcEmitter& e, Environment env) {
+    e1->code_bc(e, env);
+    e.Emit(BC_NEG);
+}
+
+void lt_class::code_bc(BcEmitter& e, Environment env) {
+    code_binary_bc(e1, e2, BC_LT, e, env);
+}
+
+void eq_class::code_bc(BcEmitter& e, Environment env) {
+    code_binary_bc(e1, e2, BC_EQ, e, env);
+}
+
+void leq_class::code_bc(BcEmitter& e, Environment env) {
+    code_binary_bc(e1, e2, BC_LEQ, e, env);
+}
+
+void comp_class::code_bc(BcEmitter& e, Environment env) {
+    e1->code_bc(e, env);
+    e.Emit(BC_NOT);
+}
+
+void int_const_class::code_bc(BcEmitter& e, Environment env) {
+    e.Emit(BC_LOAD_CONST, e.IntConst(atoi(token->get_string())));
+}
+
+void string_const_class::code_bc(BcEmitter& e, Environment env) {
+    e.Emit(BC_LOAD_CONST, e.StringConst(std::string(token->get_string(), token->get_len())));
+}
+
+void bool_const_class::code_bc(BcEmitter& e, Environment env) {
+    e.Emit(BC_LOAD_CONST, e.BoolConst(val));
+}
+
+void new__class::code_bc(BcEmitter& e, Environment env) {
+    if (type_name == SELF_TYPE) {
+        e.Emit(BC_NEW_SELF);
+    } else {
+        e.Emit(BC_NEW, codegen_classtable->GetClassNode(type_name)->class_tag);
+    }
+}
+
+void isvoid_class::code_bc(BcEmitter& e, Environment env) {
+    e1->code_bc(e, env);
+    e.Emit(BC_ISVOID);
+}
+
+void no_expr_class::code_bc(BcEmitter& e, Environment env) {
+    e.Emit(BC_LOAD_VOID);
+}
+
+void object_class::code_bc(BcEmitter& e, Environment env) {
+    int idx;
+    if (name == self) {
+        e.Emit(BC_LOAD_SELF);
+    } else if ((idx = env.LookUpVar(name)) != -1) {
+        e.Emit(BC_LOAD_LOCAL, e.SlotLocal(env, idx));
+    } else if ((idx = env.LookUpParam(name)) != -1) {
+        e.Emit(BC_LOAD_LOCAL, e.ParamLocal(env, idx));
+    } else if ((idx = env.LookUpAttrib(name)) != -1) {
+        e.Emit(BC_LOAD_ATTR, idx);
+    }
+}
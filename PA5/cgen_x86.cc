@@ -0,0 +1,718 @@
+//**************************************************************
+//
+// x86-64 code generator, selected by -x.
+//
+// Emits assembly for the GNU assembler that gcc links with the C
+// runtime in runtime_x86.c into a native executable:
+//
+//    cgen -x < prog.ast > prog.s
+//    gcc prog.s runtime_x86.c -o prog
+//
+// The class tables, prototype objects and constants are laid out like
+// the MIPS ones (see emit_x86.h); the code is a plain accumulator
+// machine without the MIPS backend's optimizations.
+//
+// Calling convention of methods: the caller pushes the actuals, puts
+// the receiver in %rax and calls; the callee returns its value in
+// %rax and pops the actuals. %rbx holds self and is saved by the
+// callee. Frames look like this, from high to low addresses:
+//
+//    actual 0 .. actual n-1, return addr, saved %rbp, saved %rbx,
+//    slot 0, slot 1, ...
+//
+// %rbp points at the saved %rbp, so actual i is at 8 * (n - i + 1) and
+// slot i at -8 * (i + 2). There is no collector: the runtime allocates
+// from large chunks and never frees.
+//
+//**************************************************************
+
+#include <string>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <map>
+
+#include "cgen.h"
+#include "emit_x86.h"
+
+extern void emit_string_constant(ostream& str, char* s);
+extern CgenClassTable* codegen_classtable;
+extern BoolConst falsebool;
+extern BoolConst truebool;
+
+extern Symbol
+    Bool,
+    Int,
+    No_class,
+    SELF_TYPE,
+    self,
+    Str,
+    str_field,
+    val;
+
+// The generator runs on one thread, so labels are simply numbered.
+static int x86_labelnum = 0;
+
+//////////////////////////////////////////////////////////////////////////////
+//
+//  emit_* procedures
+//
+//////////////////////////////////////////////////////////////////////////////
+
+static void emit_label_ref(int l, ostream& s) {
+    s << ".L" << l;
+}
+
+static void emit_label_def(int l, ostream& s) {
+    emit_label_ref(l, s);
+    s << LABEL;
+}
+
+static void emit_jump(const char* opcode, int l, ostream& s) {
+    s << opcode;
+    emit_label_ref(l, s);
+    s << endl;
+}
+
+static void emit_mov(const char* src, const char* dest, ostream& s) {
+    s << MOVQ << src << ", " << dest << endl;
+}
+
+static void emit_load(const char* dest, int offset, const char* base, ostream& s) {
+    s << MOVQ << offset << "(" << base << "), " << dest << endl;
+}
+
+static void emit_store(const char* src, int offset, const char* base, ostream& s) {
+    s << MOVQ << src << ", " << offset << "(" << base << ")" << endl;
+}
+
+static void emit_load_address(const char* dest, const std::string& label, ostream& s) {
+    s << LEAQ << label << "(" << RIP << "), " << dest << endl;
+}
+
+static void emit_load_string(const char* dest, StringEntry* str, ostream& s) {
+    s << LEAQ;
+    str->code_ref(s);
+    s << "(" << RIP << "), " << dest << endl;
+}
+
+static void emit_load_int(const char* dest, IntEntry* i, ostream& s) {
+    s << LEAQ;
+    i->code_ref(s);
+    s << "(" << RIP << "), " << dest << endl;
+}
+
+static void emit_load_bool(const char* dest, const BoolConst& b, ostream& s) {
+    s << LEAQ;
+    b.code_ref(s);
+    s << "(" << RIP << "), " << dest << endl;
+}
+
+static void emit_load_slot(const char* dest, int slot, ostream& s) {
+    emit_load(dest, -X86_WORD_SIZE * (slot + 2), RBP, s);
+}
+
+static void emit_store_slot(const char* src, int slot, ostream& s) {
+    emit_store(src, -X86_WORD_SIZE * (slot + 2), RBP, s);
+}
+
+static void emit_load_param(const char* dest, int idx, ostream& s) {
+    emit_load(dest, X86_WORD_SIZE * (idx + 2), RBP, s);
+}
+
+static void emit_store_param(const char* src, int idx, ostream& s) {
+    emit_store(src, X86_WORD_SIZE * (idx + 2), RBP, s);
+}
+
+// Loads the value of the Int or Bool at offset 0 of base into the 32-bit
+// register dest.
+static void emit_load_value(const char* dest, const char* base, ostream& s) {
+    s << MOVL << X86_INT_OFFSET << "(" << base << "), " << dest << endl;
+}
+
+// Calls the C function f of the runtime. C wants the stack aligned to 16
+// bytes, which generated code does not keep, so %rsp is saved in %r12.
+static void emit_ccall(const std::string& f, ostream& s) {
+    emit_mov(RSP, R12, s);
+    s << ANDQ << "$-16, " << RSP << endl;
+    s << CALL << f << endl;
+    emit_mov(R12, RSP, s);
+}
+
+// Calls one of the abort routines, which report where expr is and exit.
+static void emit_abort(const char* routine, Expression expr, Environment& env, ostream& s) {
+    emit_load_string(RDI, stringtable.lookup_string(env.m_class_node->get_filename()->get_string()), s);
+    s << MOVL << "$" << expr->get_line_number() << ", " << ESI << endl;
+    s << ANDQ << "$-16, " << RSP << endl;
+    s << CALL << X86_PREFIX << routine << endl;
+}
+
+// Jumps over the abort when ACC is not void.
+static void emit_void_check(const char* routine, Expression expr, Environment& env, ostream& s) {
+    int ok = x86_labelnum++;
+    s << TESTQ << RAX << ", " << RAX << endl;
+    emit_jump(JNE, ok, s);
+    emit_abort(routine, expr, env, s);
+    emit_label_def(ok, s);
+}
+
+// ACC becomes true if the flags say cmov_false does not hold.
+static void emit_flags_to_bool(const char* cmov_false, ostream& s) {
+    emit_load_bool(RAX, truebool, s);
+    emit_load_bool(RDX, falsebool, s);
+    s << cmov_false << RDX << ", " << RAX << endl;
+}
+
+// The prologue and epilogue are added once the body is generated and the
+// number of slots is known.
+static void emit_frame(const std::string& body, int slots, int arg_num, ostream& s) {
+    s << PUSHQ << RBP << endl;
+    emit_mov(RSP, RBP, s);
+    s << PUSHQ << RBX << endl;
+    emit_mov(RAX, RBX, s);
+    if (slots != 0) {
+        s << SUBQ << "$" << X86_WORD_SIZE * slots << ", " << RSP << endl;
+    }
+    s << endl;
+
+    s << body;
+    s << endl;
+
+    emit_load(RBX, -X86_WORD_SIZE, RBP, s);
+    s << LEAVE;
+    s << RETQ;
+    if (arg_num != 0) {
+        s << "$" << X86_WORD_SIZE * arg_num;
+    }
+    s << endl << endl;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+//  CgenClassTable methods
+//
+//////////////////////////////////////////////////////////////////////////////
+
+void CgenClassTable::code_x86() {
+    for (CgenNode* class_node : GetClassNodes()) {
+        class_node->GetMethods();
+        class_node->GetFullMethods();
+        class_node->GetAttribs();
+        class_node->GetFullAttribs();
+        class_node->RenderLabels();
+    }
+    stringtable.add_string("");
+    inttable.add_string("0");
+
+    code_x86_global_data();
+    code_x86_class_tables();
+    code_x86_constants();
+    code_x86_text();
+    str << "\t.section\t.note.GNU-stack,\"\",@progbits" << endl;
+    exitscope();
+}
+
+void CgenClassTable::code_x86_global_data() {
+    str << "\t.data\n" << X86_ALIGN;
+    str << GLOBAL << CLASSNAMETAB << endl;
+    str << GLOBAL << INTNAME << PROTOBJ_SUFFIX << endl;
+    str << GLOBAL << STRINGNAME << PROTOBJ_SUFFIX << endl;
+    str << GLOBAL << INTTAG << endl;
+    str << GLOBAL << BOOLTAG << endl;
+    str << GLOBAL << STRINGTAG << endl;
+
+    str << INTTAG << LABEL << QUAD << intclasstag << endl;
+    str << BOOLTAG << LABEL << QUAD << boolclasstag << endl;
+    str << STRINGTAG << LABEL << QUAD << stringclasstag << endl;
+}
+
+void CgenClassTable::code_x86_class_tables() {
+    std::vector<CgenNode*> class_nodes = GetClassNodes();
+
+    str << CLASSNAMETAB << LABEL;
+    for (CgenNode* class_node : class_nodes) {
+        str << QUAD;
+        stringtable.lookup_string(class_node->name->get_string())->code_ref(str);
+        str << endl;
+    }
+
+    str << CLASSOBJTAB << LABEL;
+    for (CgenNode* class_node : class_nodes) {
+        str << QUAD << class_node->m_protobj_label << endl;
+        str << QUAD << class_node->m_init_label << endl;
+    }
+
+    for (CgenNode* class_node : class_nodes) {
+        str << class_node->name << DISPTAB_SUFFIX << LABEL;
+        std::map<Symbol, Symbol> dispatch_class_tab = class_node->GetDispatchClassTab();
+        for (method_class* method : class_node->GetFullMethods()) {
+            CgenNode* impl_node = GetClassNode(dispatch_class_tab[method->name]);
+            str << QUAD << impl_node->m_method_labels.at(method->name) << endl;
+        }
+    }
+
+    for (CgenNode* class_node : class_nodes) {
+        class_node->code_protObj_x86(str);
+    }
+}
+
+void CgenClassTable::code_x86_constants() {
+    // Strings first: their lengths are added to the Int constants.
+    for (int i = stringtable.first(); stringtable.more(i); i = stringtable.next(i)) {
+        StringEntry* entry = stringtable.lookup(i);
+        int len = entry->get_len();
+        IntEntry* len_entry = inttable.add_int(len);
+
+        entry->code_ref(str);
+        str << LABEL
+            << QUAD << stringclasstag << endl
+            << QUAD << (DEFAULT_OBJFIELDS + STRING_SLOTS + (len + X86_WORD_SIZE) / X86_WORD_SIZE) << endl
+            << QUAD << Str << DISPTAB_SUFFIX << endl
+            << QUAD;
+        len_entry->code_ref(str);
+        str << endl;
+        emit_string_constant(str, entry->get_string());
+        str << X86_ALIGN;
+    }
+
+    for (int i = inttable.first(); inttable.more(i); i = inttable.next(i)) {
+        IntEntry* entry = inttable.lookup(i);
+        entry->code_ref(str);
+        str << LABEL
+            << QUAD << intclasstag << endl
+            << QUAD << (DEFAULT_OBJFIELDS + INT_SLOTS) << endl
+            << QUAD << Int << DISPTAB_SUFFIX << endl
+            << QUAD << entry->get_string() << endl;
+    }
+
+    for (int i = 0; i < 2; ++i) {
+        BoolConst(i).code_ref(str);
+        str << LABEL
+            << QUAD << boolclasstag << endl
+            << QUAD << (DEFAULT_OBJFIELDS + BOOL_SLOTS) << endl
+            << QUAD << Bool << DISPTAB_SUFFIX << endl
+            << QUAD << i << endl;
+    }
+}
+
+void CgenClassTable::code_x86_text() {
+    str << "\n\t.text\n";
+    str << GLOBAL << X86_MAIN << endl;
+    str << X86_MAIN << LABEL;
+    str << "\t# called from C: save what C expects preserved" << endl;
+    str << PUSHQ << RBP << endl;
+    str << PUSHQ << RBX << endl;
+    str << PUSHQ << R12 << endl;
+    emit_load_address(RDI, std::string(MAINNAME) + PROTOBJ_SUFFIX, str);
+    str << CALL << X86_PREFIX << "copy" << endl;
+    str << CALL << MAINNAME << CLASSINIT_SUFFIX << endl;
+    str << CALL << MAINNAME << METHOD_SEP << "main" << endl;
+    str << POPQ << R12 << endl;
+    str << POPQ << RBX << endl;
+    str << POPQ << RBP << endl;
+    str << RETQ << endl << endl;
+
+    for (CgenNode* class_node : GetClassNodes()) {
+        class_node->code_init_x86(str);
+        for (method_class* method : class_node->GetMethods()) {
+            method->code_x86(str, class_node);
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+//  CgenNode methods
+//
+//////////////////////////////////////////////////////////////////////////////
+
+void CgenNode::code_protObj_x86(ostream& s) {
+    std::vector<attr_class*> attribs = GetFullAttribs();
+
+    s << m_protobj_label << LABEL;
+    s << QUAD << class_tag << "\t# class tag" << endl;
+    s << QUAD << (DEFAULT_OBJFIELDS + attribs.size()) << "\t# size" << endl;
+    s << QUAD << name << DISPTAB_SUFFIX << endl;
+
+    for (attr_class* attrib : attribs) {
+        Symbol type = attrib->type_decl;
+        s << QUAD;
+        if (attrib->name == val && name == Str) {
+            inttable.lookup_string("0")->code_ref(s);
+        } else if (attrib->name == val || attrib->name == str_field) {
+            s << "0";
+        } else if (type == Int) {
+            inttable.lookup_string("0")->code_ref(s);
+        } else if (type == Bool) {
+            falsebool.code_ref(s);
+        } else if (type == Str) {
+            stringtable.lookup_string("")->code_ref(s);
+        } else {
+            s << "0";
+        }
+        s << endl;
+    }
+}
+
+void CgenNode::code_init_x86(ostream& s) {
+    s << m_init_label << LABEL;
+    if (basic()) {
+        s << RETQ << endl << endl;
+        return;
+    }
+
+    std::ostringstream body;
+    int slots = 0;
+    Environment env;
+    env.m_class_node = this;
+    env.m_max_slots = &slots;
+
+    if (!get_parentnd()->basic()) {
+        body << CALL << get_parentnd()->m_init_label << endl;
+    }
+    for (attr_class* attrib : GetAttribs()) {
+        if (attrib->init->IsEmpty()) {
+            continue;
+        }
+        body << "\t# init " << attrib->name << endl;
+        attrib->init->code_x86(body, env);
+        emit_store(RAX, X86_WORD_SIZE * (DEFAULT_OBJFIELDS + env.LookUpAttrib(attrib->name)), RBX, body);
+    }
+    emit_mov(RBX, RAX, body);
+
+    emit_frame(body.str(), slots, 0, s);
+}
+
+//
+// Basic methods call the C functions of the runtime, which take self and
+// the actuals as their arguments.
+//
+static void code_basic_method_x86(method_class* method, CgenNode* class_node, ostream& s) {
+    static const char* const c_args[] = { RSI, RDX };
+    int arg_num = method->GetArgNum();
+
+    s << class_node->m_method_labels.at(method->name) << LABEL;
+    s << PUSHQ << RBP << endl;
+    emit_mov(RSP, RBP, s);
+    emit_mov(RAX, RDI, s);
+    for (int i = 0; i < arg_num; ++i) {
+        emit_load_param(c_args[i], arg_num - 1 - i, s);
+    }
+    s << ANDQ << "$-16, " << RSP << endl;
+    s << CALL << X86_PREFIX << class_node->name << "_" << method->name << endl;
+    s << LEAVE;
+    s << RETQ;
+    if (arg_num != 0) {
+        s << "$" << X86_WORD_SIZE * arg_num;
+    }
+    s << endl << endl;
+}
+
+void method_class::code_x86(ostream& s, CgenNode* class_node) {
+    if (class_node->basic()) {
+        code_basic_method_x86(this, class_node, s);
+        return;
+    }
+
+    s << class_node->m_method_labels.at(name) << LABEL;
+
+    std::ostringstream body;
+    int slots = 0;
+    Environment env;
+    env.m_class_node = class_node;
+    env.m_max_slots = &slots;
+    for (int i = formals->first(); formals->more(i); i = formals->next(i)) {
+        env.AddParam(formals->nth(i)->GetName());
+    }
+    expr->code_x86(body, env);
+
+    emit_frame(body.str(), slots, GetArgNum(), s);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Expressions: each leaves its value in %rax.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+void assign_class::code_x86(ostream& s, Environment env) {
+    expr->code_x86(s, env);
+
+    int idx;
+    if ((idx = env.LookUpVar(name)) != -1) {
+        emit_store_slot(RAX, idx, s);
+    } else if ((idx = env.LookUpParam(name)) != -1) {
+        emit_store_param(RAX, idx, s);
+    } else if ((idx = env.LookUpAttrib(name)) != -1) {
+        emit_store(RAX, X86_WORD_SIZE * (DEFAULT_OBJFIELDS + idx), RBX, s);
+    }
+}
+
+// Pushes the actuals, first to last, for a call.
+static void emit_actuals(Expressions actual, Environment& env, ostream& s) {
+    for (int i = actual->first(); actual->more(i); i = actual->next(i)) {
+        actual->nth(i)->code_x86(s, env);
+        s << PUSHQ << RAX << endl;
+    }
+}
+
+void static_dispatch_class::code_x86(ostream& s, Environment env) {
+    s << "\t# static dispatch " << type_name << METHOD_SEP << name << endl;
+    emit_actuals(actual, env, s);
+    expr->code_x86(s, env);
+    emit_void_check("dispatch_abort", this, env, s);
+
+    CgenNode* class_node = codegen_classtable->GetClassNode(type_name);
+    CgenNode* impl_node = codegen_classtable->GetClassNode(class_node->GetDispatchClassTab()[name]);
+    s << CALL << impl_node->m_method_labels.at(name) << endl;
+}
+
+void dispatch_class::code_x86(ostream& s, Environment env) {
+    s << "\t# dispatch " << name << endl;
+    emit_actuals(actual, env, s);
+    expr->code_x86(s, env);
+    emit_void_check("dispatch_abort", this, env, s);
+
+    Symbol type = expr->get_type();
+    CgenNode* class_node = type == SELF_TYPE ? env.m_class_node : codegen_classtable->GetClassNode(type);
+    emit_load(RDX, X86_WORD_SIZE * DISPTABLE_OFFSET, RAX, s);
+    s << CALL << "*" << X86_WORD_SIZE * class_node->GetDispatchIdxTab()[name] << "(" << RDX << ")" << endl;
+}
+
+void cond_class::code_x86(ostream& s, Environment env) {
+    int else_label = x86_labelnum++;
+    int finish = x86_labelnum++;
+
+    pred->code_x86(s, env);
+    s << CMPL << "$0, " << X86_INT_OFFSET << "(" << RAX << ")" << endl;
+    emit_jump(JE, else_label, s);
+    then_exp->code_x86(s, env);
+    emit_jump(JMP, finish, s);
+    emit_label_def(else_label, s);
+    else_exp->code_x86(s, env);
+    emit_label_def(finish, s);
+}
+
+void loop_class::code_x86(ostream& s, Environment env) {
+    int start = x86_labelnum++;
+    int finish = x86_labelnum++;
+
+    emit_label_def(start, s);
+    pred->code_x86(s, env);
+    s << CMPL << "$0, " << X86_INT_OFFSET << "(" << RAX << ")" << endl;
+    emit_jump(JE, finish, s);
+    body->code_x86(s, env);
+    emit_jump(JMP, start, s);
+    emit_label_def(finish, s);
+    s << "\t# a loop is void" << endl;
+    s << MOVL << "$0, " << EAX << endl;
+}
+
+void typcase_class::code_x86(ostream& s, Environment env) {
+    s << "\t# case" << endl;
+    expr->code_x86(s, env);
+    emit_void_check("case_abort2", this, env, s);
+    emit_load(RCX, X86_WORD_SIZE * TAG_OFFSET, RAX, s);
+
+    // Most specific first, so that the first range holding the tag belongs
+    // to the closest ancestor of the dynamic type.
+    std::vector<branch_class*> cases = GetCases();
+    std::stable_sort(cases.begin(), cases.end(),
+        [](branch_class* a, branch_class* b) {
+            return codegen_classtable->GetClassNode(a->type_decl)->GetInheritance().size() >
+                   codegen_classtable->GetClassNode(b->type_decl)->GetInheritance().size();
+        });
+
+    int finish = x86_labelnum++;
+    for (branch_class* branch : cases) {
+        CgenNode* case_node = codegen_classtable->GetClassNode(branch->type_decl);
+        int next = x86_labelnum++;
+        s << "\t# tag in [" << case_node->class_tag << ", " << case_node->class_tag_end
+          << "] : case " << branch->type_decl << endl;
+        s << CMPQ << "$" << case_node->class_tag << ", " << RCX << endl;
+        emit_jump(JL, next, s);
+        s << CMPQ << "$" << case_node->class_tag_end << ", " << RCX << endl;
+        emit_jump(JG, next, s);
+
+        Environment case_env = env;
+        case_env.EnterScope();
+        emit_store_slot(RAX, case_env.AddVar(branch->name), s);
+        branch->expr->code_x86(s, case_env);
+        emit_jump(JMP, finish, s);
+        emit_label_def(next, s);
+    }
+
+    s << "\t# no match" << endl;
+    emit_mov(RAX, RDI, s);
+    s << ANDQ << "$-16, " << RSP << endl;
+    s << CALL << X86_PREFIX << "case_abort" << endl;
+    emit_label_def(finish, s);
+}
+
+void block_class::code_x86(ostream& s, Environment env) {
+    for (int i = body->first(); body->more(i); i = body->next(i)) {
+        body->nth(i)->code_x86(s, env);
+    }
+}
+
+void let_class::code_x86(ostream& s, Environment env) {
+    init->code_x86(s, env);
+    if (init->IsEmpty()) {
+        if (type_decl == Str) {
+            emit_load_string(RAX, stringtable.lookup_string(""), s);
+        } else if (type_decl == Int) {
+            emit_load_int(RAX, inttable.lookup_string("0"), s);
+        } else if (type_decl == Bool) {
+            emit_load_bool(RAX, falsebool, s);
+        }
+    }
+
+    env.EnterScope();
+    emit_store_slot(RAX, env.AddVar(identifier), s);
+    body->code_x86(s, env);
+}
+
+// Evaluates e1 and e2, leaving e1 in %rdx and e2 in %rax.
+static void emit_operands(Expression e1, Expression e2, Environment env, ostream& s) {
+    e1->code_x86(s, env);
+    int slot = env.AddObstacle();
+    emit_store_slot(RAX, slot, s);
+    e2->code_x86(s, env);
+    emit_load_slot(RDX, slot, s);
+}
+
+// The Int result, whose value is in %edi, is a new object.
+static void emit_new_int(ostream& s) {
+    emit_ccall(std::string(X86_PREFIX) + "new_int", s);
+}
+
+static void emit_arith(Expression e1, Expression e2, const char* opcode, Environment env, ostream& s) {
+    emit_operands(e1, e2, env, s);
+    emit_load_value(EDI, RDX, s);
+    s << opcode << X86_INT_OFFSET << "(" << RAX << "), " << EDI << endl;
+    emit_new_int(s);
+}
+
+void plus_class::code_x86(ostream& s, Environment env) {
+    emit_arith(e1, e2, ADDL, env, s);
+}
+
+void sub_class::code_x86(ostream& s, Environment env) {
+    emit_arith(e1, e2, SUBL, env, s);
+}
+
+void mul_class::code_x86(ostream& s, Environment env) {
+    emit_arith(e1, e2, IMULL, env, s);
+}
+
+void divide_class::code_x86(ostream& s, Environment env) {
+    emit_operands(e1, e2, env, s);
+    emit_mov(RAX, RCX, s);
+    emit_load_value(EAX, RDX, s);
+    s << CLTD;
+    s << IDIVL << X86_INT_OFFSET << "(" << RCX << ")" << endl;
+    s << MOVL << EAX << ", " << EDI << endl;
+    emit_new_int(s);
+}
+
+void neg_class::code_x86(ostream& s, Environment env) {
+    e1->code_x86(s, env);
+    emit_load_value(EDI, RAX, s);
+    s << NEGL << EDI << endl;
+    emit_new_int(s);
+}
+
+void lt_class::code_x86(ostream& s, Environment env) {
+    emit_operands(e1, e2, env, s);
+    emit_load_value(ECX, RDX, s);
+    s << CMPL << X86_INT_OFFSET << "(" << RAX << "), " << ECX << endl;
+    emit_flags_to_bool(CMOVGE, s);
+}
+
+void leq_class::code_x86(ostream& s, Environment env) {
+    emit_operands(e1, e2, env, s);
+    emit_load_value(ECX, RDX, s);
+    s << CMPL << X86_INT_OFFSET << "(" << RAX << "), " << ECX << endl;
+    emit_flags_to_bool(CMOVG, s);
+}
+
+void eq_class::code_x86(ostream& s, Environment env) {
+    emit_operands(e1, e2, env, s);
+    int equal = x86_labelnum++;
+    int finish = x86_labelnum++;
+    s << CMPQ << RAX << ", " << RDX << endl;
+    emit_jump(JE, equal, s);
+    emit_mov(RDX, RDI, s);
+    emit_mov(RAX, RSI, s);
+    emit_ccall(std::string(X86_PREFIX) + "equality_test", s);
+    s << TESTQ << RAX << ", " << RAX << endl;
+    emit_jump(JNE, equal, s);
+    emit_load_bool(RAX, falsebool, s);
+    emit_jump(JMP, finish, s);
+    emit_label_def(equal, s);
+    emit_load_bool(RAX, truebool, s);
+    emit_label_def(finish, s);
+}
+
+void comp_class::code_x86(ostream& s, Environment env) {
+    e1->code_x86(s, env);
+    s << CMPL << "$0, " << X86_INT_OFFSET << "(" << RAX << ")" << endl;
+    emit_flags_to_bool(CMOVNE, s);
+}
+
+void int_const_class::code_x86(ostream& s, Environment env) {
+    emit_load_int(RAX, inttable.lookup_string(token->get_string()), s);
+}
+
+void string_const_class::code_x86(ostream& s, Environment env) {
+    emit_load_string(RAX, stringtable.lookup_string(token->get_string()), s);
+}
+
+void bool_const_class::code_x86(ostream& s, Environment env) {
+    emit_load_bool(RAX, BoolConst(val), s);
+}
+
+void new__class::code_x86(ostream& s, Environment env) {
+    if (type_name != SELF_TYPE) {
+        CgenNode* class_node = codegen_classtable->GetClassNode(type_name);
+        emit_load_address(RDI, class_node->m_protobj_label, s);
+        emit_ccall(std::string(X86_PREFIX) + "copy", s);
+        s << CALL << class_node->m_init_label << endl;
+        return;
+    }
+
+    s << "\t# new SELF_TYPE: class_objTab[2 * tag] is the protObj, then the init" << endl;
+    int slot = env.AddObstacle();
+    emit_load(RCX, X86_WORD_SIZE * TAG_OFFSET, RBX, s);
+    s << SHLQ << "$4, " << RCX << endl;
+    emit_load_address(RDX, CLASSOBJTAB, s);
+    s << ADDQ << RCX << ", " << RDX << endl;
+    emit_load(RCX, X86_WORD_SIZE, RDX, s);
+    emit_store_slot(RCX, slot, s);
+    emit_load(RDI, 0, RDX, s);
+    emit_ccall(std::string(X86_PREFIX) + "copy", s);
+    s << CALL << "*" << -X86_WORD_SIZE * (slot + 2) << "(" << RBP << ")" << endl;
+}
+
+void isvoid_class::code_x86(ostream& s, Environment env) {
+    e1->code_x86(s, env);
+    s << TESTQ << RAX << ", " << RAX << endl;
+    emit_flags_to_bool(CMOVNE, s);
+}
+
+void no_expr_class::code_x86(ostream& s, Environment env) {
+    s << MOVL << "$0, " << EAX << endl;
+}
+
+void object_class::code_x86(ostream& s, Environment env) {
+    int idx;
+    if (name == self) {
+        emit_mov(RBX, RAX, s);
+    } else if ((idx = env.LookUpVar(name)) != -1) {
+        emit_load_slot(RAX, idx, s);
+    } else if ((idx = env.LookUpParam(name)) != -1) {
+        emit_load_param(RAX, idx, s);
+    } else if ((idx = env.LookUpAttrib(name)) != -1) {
+        emit_load(RAX, X86_WORD_SIZE * (DEFAULT_OBJFIELDS + idx), RBX, s);
+    }
+}
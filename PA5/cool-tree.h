@@ -80,6 +80,14 @@ public:
    tree_node *copy()     { return copy_Expression(); }
    virtual Expression copy_Expression() = 0;
    virtual bool IsEmpty() { return false; }
+   // Number of expression nodes in this subtree.
+   virtual int GetSize() { return 1; }
+   // True if the value is always one of the statically allocated
+   // constants, never an object in the heap.
+   virtual bool IsStaticValue() { return false; }
+   // False if evaluating the expression can never allocate, and so can
+   // never start a garbage collection.
+   virtual bool MayAllocate() { return true; }
 #ifdef Expression_EXTRAS
    Expression_EXTRAS
 #endif
@@ -174,6 +182,7 @@ public:
 };
 
 class CgenNode;
+class BcEmitter;
 
 // define constructor - method
 class method_class : public Feature_class {
@@ -193,6 +202,8 @@ public:
    void dump(ostream& stream, int n);
    bool IsMethod() { return true; }
    void code(ostream& stream, CgenNode* class_node);
+   void code_x86(ostream& stream, CgenNode* class_node);
+   void code_bc(BcEmitter& e, CgenNode* class_node);
    int GetArgNum() {
       int ret = 0;
       for (int i = formals->first(); formals->more(i); i = formals->next(i)) {
@@ -291,6 +302,7 @@ public:
    }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
+   int GetSize() { return 1 + expr->GetSize(); }
 
 #ifdef Expression_SHARED_EXTRAS
    Expression_SHARED_EXTRAS
@@ -317,6 +329,13 @@ public:
    }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
+   int GetSize() {
+      int ret = 1 + expr->GetSize();
+      for (int i = actual->first(); actual->more(i); i = actual->next(i)) {
+         ret += actual->nth(i)->GetSize();
+      }
+      return ret;
+   }
    std::vector<Expression> GetActuals() {
       std::vector<Expression> ret;
       for (int i = actual->first(); actual->more(i); i = actual->next(i)) {
@@ -347,6 +366,13 @@ public:
    }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
+   int GetSize() {
+      int ret = 1 + expr->GetSize();
+      for (int i = actual->first(); actual->more(i); i = actual->next(i)) {
+         ret += actual->nth(i)->GetSize();
+      }
+      return ret;
+   }
    std::vector<Expression> GetActuals() {
       std::vector<Expression> ret;
       for (int i = actual->first(); actual->more(i); i = actual->next(i)) {
@@ -377,6 +403,7 @@ public:
    }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
+   int GetSize() { return 1 + pred->GetSize() + then_exp->GetSize() + else_exp->GetSize(); }
 
 #ifdef Expression_SHARED_EXTRAS
    Expression_SHARED_EXTRAS
@@ -399,6 +426,7 @@ public:
    }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
+   int GetSize() { return 1 + pred->GetSize() + body->GetSize(); }
 
 #ifdef Expression_SHARED_EXTRAS
    Expression_SHARED_EXTRAS
@@ -421,6 +449,13 @@ public:
    }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
+   int GetSize() {
+      int ret = 1 + expr->GetSize();
+      for (branch_class* branch : GetCases()) {
+         ret += branch->expr->GetSize();
+      }
+      return ret;
+   }
    std::vector<branch_class*> GetCases() {
       std::vector<branch_class*> ret;
       for (int i = cases->first(); cases->more(i); i = cases->next(i)) {
@@ -447,6 +482,13 @@ public:
    }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
+   int GetSize() {
+      int ret = 1;
+      for (int i = body->first(); body->more(i); i = body->next(i)) {
+         ret += body->nth(i)->GetSize();
+      }
+      return ret;
+   }
 
 #ifdef Expression_SHARED_EXTRAS
    Expression_SHARED_EXTRAS
@@ -473,6 +515,7 @@ public:
    }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
+   int GetSize() { return 1 + init->GetSize() + body->GetSize(); }
 
 #ifdef Expression_SHARED_EXTRAS
    Expression_SHARED_EXTRAS
@@ -495,6 +538,7 @@ public:
    }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
+   int GetSize() { return 1 + e1->GetSize() + e2->GetSize(); }
 
 #ifdef Expression_SHARED_EXTRAS
    Expression_SHARED_EXTRAS
@@ -517,6 +561,7 @@ public:
    }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
+   int GetSize() { return 1 + e1->GetSize() + e2->GetSize(); }
 
 #ifdef Expression_SHARED_EXTRAS
    Expression_SHARED_EXTRAS
@@ -539,6 +584,7 @@ public:
    }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
+   int GetSize() { return 1 + e1->GetSize() + e2->GetSize(); }
 
 #ifdef Expression_SHARED_EXTRAS
    Expression_SHARED_EXTRAS
@@ -561,6 +607,7 @@ public:
    }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
+   int GetSize() { return 1 + e1->GetSize() + e2->GetSize(); }
 
 #ifdef Expression_SHARED_EXTRAS
    Expression_SHARED_EXTRAS
@@ -581,6 +628,7 @@ public:
    }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
+   int GetSize() { return 1 + e1->GetSize(); }
 
 #ifdef Expression_SHARED_EXTRAS
    Expression_SHARED_EXTRAS
@@ -603,6 +651,8 @@ public:
    }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
+   int GetSize() { return 1 + e1->GetSize() + e2->GetSize(); }
+   bool IsStaticValue() { return true; }
 
 #ifdef Expression_SHARED_EXTRAS
    Expression_SHARED_EXTRAS
@@ -625,6 +675,8 @@ public:
    }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
+   int GetSize() { return 1 + e1->GetSize() + e2->GetSize(); }
+   bool IsStaticValue() { return true; }
 
 #ifdef Expression_SHARED_EXTRAS
    Expression_SHARED_EXTRAS
@@ -647,6 +699,8 @@ public:
    }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
+   int GetSize() { return 1 + e1->GetSize() + e2->GetSize(); }
+   bool IsStaticValue() { return true; }
 
 #ifdef Expression_SHARED_EXTRAS
    Expression_SHARED_EXTRAS
@@ -667,6 +721,8 @@ public:
    }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
+   int GetSize() { return 1 + e1->GetSize(); }
+   bool IsStaticValue() { return true; }
 
 #ifdef Expression_SHARED_EXTRAS
    Expression_SHARED_EXTRAS
@@ -687,6 +743,8 @@ public:
    }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
+   bool IsStaticValue() { return true; }
+   bool MayAllocate() { return false; }
 
 #ifdef Expression_SHARED_EXTRAS
    Expression_SHARED_EXTRAS
@@ -707,6 +765,8 @@ public:
    }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
+   bool IsStaticValue() { return true; }
+   bool MayAllocate() { return false; }
 
 #ifdef Expression_SHARED_EXTRAS
    Expression_SHARED_EXTRAS
@@ -727,6 +787,8 @@ public:
    }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
+   bool IsStaticValue() { return true; }
+   bool MayAllocate() { return false; }
 
 #ifdef Expression_SHARED_EXTRAS
    Expression_SHARED_EXTRAS
@@ -767,6 +829,8 @@ public:
    }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
+   int GetSize() { return 1 + e1->GetSize(); }
+   bool IsStaticValue() { return true; }
 
 #ifdef Expression_SHARED_EXTRAS
    Expression_SHARED_EXTRAS
@@ -785,6 +849,7 @@ public:
    }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
+   bool MayAllocate() { return false; }
    bool IsEmpty() { return true; }
 #ifdef Expression_SHARED_EXTRAS
    Expression_SHARED_EXTRAS
@@ -805,6 +870,7 @@ public:
    }
    Expression copy_Expression();
    void dump(ostream& stream, int n);
+   bool MayAllocate() { return false; }
 
 #ifdef Expression_SHARED_EXTRAS
    Expression_SHARED_EXTRAS
@@ -12,6 +12,7 @@
 extern int yylineno;
 
 class Environment;
+class BcEmitter;
 
 inline Boolean copy_Boolean(Boolean b) {return b; }
 inline void assert_Boolean(Boolean) {}
@@ -99,12 +100,16 @@ Symbol type;                                 \
 Symbol get_type() { return type; }           \
 Expression set_type(Symbol s) { type = s; return this; } \
 virtual void code(ostream&, Environment) = 0; \
+virtual void code_x86(ostream&, Environment) = 0; \
+virtual void code_bc(BcEmitter&, Environment) = 0; \
 virtual void dump_with_types(ostream&,int) = 0;  \
 void dump_type(ostream&, int);               \
 Expression_class() { type = (Symbol) NULL; }
 
 #define Expression_SHARED_EXTRAS           \
 void code(ostream&, Environment); 			   \
+void code_x86(ostream&, Environment);			   \
+void code_bc(BcEmitter&, Environment);			   \
 void dump_with_types(ostream&,int); 
 
 
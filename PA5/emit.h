@@ -7,6 +7,7 @@
 //     Class init code           <classname>_init
 //     Abort method entry        <classname>.<method>.Abort
 //     Prototype object          <classname>_protObj
+//     Register args adapter     <classname>.<method>_regargs
 //     Integer constant          int_const<Symbol>
 //     String constant           str_const<Symbol>
 //
@@ -25,12 +26,40 @@
 #define BOOLTAG              "_bool_tag"
 #define STRINGTAG            "_string_tag"
 #define HEAP_START           "heap_start"
+#define INTPOOL              "int_pool"
+#define PROFCOUNTS           "_prof_counts"
+#define PROFNAMES            "_prof_names"
+#define PROFKINDS            "_prof_kinds"
+#define PROFTAGS             "_prof_tags"
+#define PROFNUM              "_prof_num"
+#define OUTBUF               "_out_buf"
+#define OUTLEN               "_out_len"
+#define OUTFLUSH             "_out_flush"
+#define OUTBUF_SIZE          4096
+
+// Small Ints. Arithmetic results, and those of in_int, in
+// [INT_POOL_MIN, INT_POOL_MAX] are taken from a table of preboxed Ints at
+// INTPOOL instead of being copied. The range may be set when building
+// cgen, e.g. with -DINT_POOL_MIN=-16 -DINT_POOL_MAX=255 in CFLAGS.
+#ifndef INT_POOL_MIN
+#define INT_POOL_MIN         (-128)
+#endif
+#ifndef INT_POOL_MAX
+#define INT_POOL_MAX         1023
+#endif
+#if INT_POOL_MIN > INT_POOL_MAX || INT_POOL_MIN < -32767
+#error "INT_POOL_MIN must be at most INT_POOL_MAX and fit an addiu"
+#endif
 
 // Naming conventions
 #define DISPTAB_SUFFIX       "_dispTab"
 #define METHOD_SEP           "."
 #define CLASSINIT_SUFFIX     "_init"
 #define PROTOBJ_SUFFIX       "_protObj"
+#define REGARGS_SUFFIX       "_regargs"
+#define PROFTAB_SUFFIX       "_profTab"
+#define BUFFERED_SUFFIX      "_buffered"
+#define MAINBODY_SUFFIX      "_body"
 #define OBJECTPROTOBJ        "Object"PROTOBJ_SUFFIX
 #define INTCONST_PREFIX      "int_const"
 #define STRCONST_PREFIX      "str_const"
@@ -67,23 +96,35 @@
 #define ZERO "$zero"		// Zero register 
 #define ACC  "$a0"		// Accumulator 
 #define A1   "$a1"		// For arguments to prim funcs 
+#define A2   "$a2"		// Register arguments (-a) 
+#define A3   "$a3"		// Register arguments (-a) 
 #define SELF "$s0"		// Ptr to self (callee saves) 
 #define T1   "$t1"		// Temporary 1 
 #define T2   "$t2"		// Temporary 2 
 #define T3   "$t3"		// Temporary 3 
+#define T4   "$t4"		// Temporary 4 
+#define T5   "$t5"		// Temporary 5 
+#define V0   "$v0"		// Syscall number 
 #define SP   "$sp"		// Stack pointer 
 #define FP   "$fp"		// Frame pointer 
 #define RA   "$ra"		// Return address 
+#define GP   "$gp"		// Heap allocation pointer 
+#define LIMIT "$s7"		// Heap limit pointer 
 
 //
 // Opcodes
 //
 #define JALR  "\tjalr\t"  
 #define JAL   "\tjal\t"                 
+#define JUMP  "\tj\t"
+#define JR    "\tjr\t"
 #define RET   "\tjr\t"RA"\t"
 
 #define SW    "\tsw\t"
 #define LW    "\tlw\t"
+#define SB    "\tsb\t"
+#define LB    "\tlb\t"
+#define SYSCALL "\tsyscall"
 #define LI    "\tli\t"
 #define LA    "\tla\t"
 
@@ -104,5 +145,6 @@
 #define BLEQ     "\tble\t"
 #define BLT      "\tblt\t"
 #define BGT      "\tbgt\t"
+#define BGE      "\tbge\t"
 
 
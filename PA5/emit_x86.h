@@ -0,0 +1,74 @@
+///////////////////////////////////////////////////////////////////////
+//
+//  x86-64 backend (cgen -x), for the GNU assembler in AT&T syntax.
+//
+//  Labels follow the naming conventions of emit.h, and objects have
+//  the same fields as on MIPS, in 8-byte words: class tag, size,
+//  dispatch table, then the attributes. A String's chars follow its
+//  length, NUL terminated.
+//
+//  The basic methods and the abort routines are the C functions
+//  cool_<classname>_<method> and cool_<routine> of runtime_x86.c.
+//
+///////////////////////////////////////////////////////////////////////
+
+#define X86_WORD_SIZE     8
+#define X86_INT_OFFSET    24     // value of an Int or Bool
+#define X86_CHARS_OFFSET  32     // chars of a String
+
+#define X86_ALIGN     "\t.align\t8\n"
+#define QUAD          "\t.quad\t"
+#define X86_MAIN      "cool_main"
+#define X86_PREFIX    "cool_"
+
+//
+// register names
+//
+#define RAX  "%rax"		// Accumulator
+#define EAX  "%eax"
+#define RBX  "%rbx"		// Ptr to self (callee saves)
+#define RCX  "%rcx"		// Temporary
+#define ECX  "%ecx"
+#define RDX  "%rdx"		// Temporary
+#define RDI  "%rdi"		// First arg to C functions
+#define EDI  "%edi"
+#define RSI  "%rsi"		// Second arg to C functions
+#define ESI  "%esi"
+#define R12  "%r12"		// Stack pointer across C calls (callee saves)
+#define RBP  "%rbp"		// Frame pointer
+#define RSP  "%rsp"		// Stack pointer
+#define RIP  "%rip"
+
+//
+// Opcodes
+//
+#define MOVQ    "\tmovq\t"
+#define MOVL    "\tmovl\t"
+#define LEAQ    "\tleaq\t"
+#define PUSHQ   "\tpushq\t"
+#define POPQ    "\tpopq\t"
+#define ADDQ    "\taddq\t"
+#define ADDL    "\taddl\t"
+#define SUBL    "\tsubl\t"
+#define SUBQ    "\tsubq\t"
+#define IMULL   "\timull\t"
+#define IDIVL   "\tidivl\t"
+#define NEGL    "\tnegl\t"
+#define ANDQ    "\tandq\t"
+#define SHLQ    "\tshlq\t"
+#define CLTD    "\tcltd\n"
+#define CMPQ    "\tcmpq\t"
+#define CMPL    "\tcmpl\t"
+#define TESTQ   "\ttestq\t"
+#define CMOVNE  "\tcmovne\t"
+#define CMOVG   "\tcmovg\t"
+#define CMOVGE  "\tcmovge\t"
+#define CALL    "\tcall\t"
+#define JMP     "\tjmp\t"
+#define JE      "\tje\t"
+#define JNE     "\tjne\t"
+#define JL      "\tjl\t"
+#define JLE     "\tjle\t"
+#define JG      "\tjg\t"
+#define LEAVE   "\tleave\n"
+#define RETQ    "\tret\t"
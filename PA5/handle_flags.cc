@@ -30,6 +30,14 @@ extern int cool_yydebug;        // for the parser
        bool disable_reg_alloc;  // Don't do register allocation
 
        int cgen_optimize;       // optimize switch for code generator 
+       int cgen_regargs;        // pass the first arguments in registers
+       int cgen_compact;        // leave comments out of the generated code
+       int cgen_unbuffered;     // print every out_string and out_int at once
+       int cgen_x86;            // generate x86-64 code instead of MIPS
+       int cgen_bytecode;       // compile to bytecode and run it
+       int cgen_bytecode_counts; // also count the opcodes executed
+       int cgen_profile;        // count calls and allocations at run time
+       char *cgen_profile_file; // receivers seen at dispatches, for -O
        char *out_filename;      // file name for generated code
        Memmgr cgen_Memmgr = GC_NOGC;      // enable/disable garbage collection
        Memmgr_Test cgen_Memmgr_Test = GC_NORMAL;  // normal/test GC
@@ -50,10 +58,18 @@ void handle_flags(int argc, char *argv[]) {
   semant_debug = 0;
   cgen_debug = 0;
   cgen_optimize = 0;
+  cgen_regargs = 0;
+  cgen_compact = 0;
+  cgen_unbuffered = 0;
+  cgen_x86 = 0;
+  cgen_bytecode = 0;
+  cgen_bytecode_counts = 0;
+  cgen_profile = 0;
+  cgen_profile_file = nullptr;
   disable_reg_alloc = 0;
   
 
-  while ((c = getopt(argc, argv, "lpscvrOo:gtT")) != -1) {
+  while ((c = getopt(argc, argv, "lpscvrOaCuxbBPF:o:gtT")) != -1) {
     switch (c) {
 #ifdef DEBUG
     case 'l':
@@ -99,6 +115,31 @@ void handle_flags(int argc, char *argv[]) {
     case 'O':  // enable optimization
       cgen_optimize = 1;
       break;
+    case 'a':  // pass the first arguments in $a1-$a3
+      cgen_regargs = 1;
+      break;
+    case 'C':  // compact output, without comments
+      cgen_compact = 1;
+      break;
+    case 'u':  // unbuffered output, with a syscall per print
+      cgen_unbuffered = 1;
+      break;
+    case 'x':  // x86-64 code, linked with runtime_x86.c
+      cgen_x86 = 1;
+      break;
+    case 'b':  // run in the bytecode VM instead of writing code
+      cgen_bytecode = 1;
+      break;
+    case 'B':  // likewise, and report the opcodes executed
+      cgen_bytecode = 1;
+      cgen_bytecode_counts = 1;
+      break;
+    case 'P':  // count method calls and allocations, see emit.h
+      cgen_profile = 1;
+      break;
+    case 'F':  // speculate on the receivers in this profile (mipsim -d)
+      cgen_profile_file = optarg;
+      break;
     case '?':
       unknownopt = 1;
       break;
@@ -111,9 +152,9 @@ void handle_flags(int argc, char *argv[]) {
   if (unknownopt) {
       cerr << "usage: " << argv[0] << 
 #ifdef DEBUG
-	  " [-lvpscOgtTr -o outname] [input-files]\n";
+	  " [-lvpscOaCuxbBPgtTr -F profile -o outname] [input-files]\n";
 #else
-      " [-OgtT -o outname] [input-files]\n";
+      " [-OaCuxbBPgtT -F profile -o outname] [input-files]\n";
 #endif
       exit(1);
   }
@@ -0,0 +1,1214 @@
+//**************************************************************
+//
+// mipsim: a small MIPS simulator for the code produced by cgen.
+//
+// It understands the subset of SPIM assembly that emit.h
+// generates and implements the runtime system (trap handler)
+// routines natively: Object.copy, equality_test, the IO and
+// String methods, the abort entries and the GC hooks, as well as
+// the syscalls that print.
+//
+// Usage: mipsim [-p] [-n top] [-d file] file.s
+//    -p       print the execution profile to stderr
+//    -n top   number of labels / methods in the profile (default 10)
+//    -d file  write the receivers seen at each dispatch to file, for
+//             cgen -F
+//
+// The profile counts the instructions executed, with a simple cycle
+// model, the loads and stores, branches, calls and allocations, the
+// prints, each of which SPIM writes to the console at once, how
+// often each label is reached and the instructions executed in each
+// method, so that every change to the code generator can be measured
+// on the same program.
+//
+// Programs compiled with cgen -g get a minor collection, like the
+// trap handler's generational collector, whenever the allocation
+// window is full, and before every allocation with -t. It copies the
+// young objects reachable from the stack, $s0 and the fields recorded
+// by _GenGC_Assign, and poisons the young generation, so that a
+// pointer it could not see faults when it is next used. The other
+// collectors never run: the heap grows instead.
+//
+// Programs compiled with cgen -P count their method calls and
+// allocations in tables of their own; when such a program ends, the
+// counts are reported to stderr, busiest first. The receivers counted
+// at the dispatches can be written to a file for cgen -F, which then
+// calls the usual ones directly.
+//
+//**************************************************************
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using std::cerr;
+using std::cout;
+using std::endl;
+
+#define TEXT_BASE    0x00400000
+#define RUNTIME_BASE 0x00300000
+#define DATA_BASE    0x10000000
+#define STACK_TOP    0x7ffefffc
+#define STACK_SIZE   (8 << 20)
+#define HEAP_SIZE    (64 << 20)
+#define HEAP_MAX     (1 << 30)
+#define ALLOC_WINDOW (16 << 10)
+#define HALT_ADDR    0x00000004
+
+//
+// object layout, see emit.h
+//
+#define TAG_OFFSET       0
+#define SIZE_OFFSET      4
+#define DISPTABLE_OFFSET 8
+#define ATTR_OFFSET      12
+#define STR_LEN_OFFSET   12
+#define STR_CHARS_OFFSET 16
+
+enum Opcode {
+    OP_LW, OP_SW, OP_LI, OP_LA, OP_MOVE, OP_NEG,
+    OP_ADD, OP_ADDI, OP_ADDU, OP_ADDIU, OP_SUB, OP_SUBU, OP_MUL, OP_DIV,
+    OP_SLL, OP_SRL, OP_SRA, OP_AND, OP_OR, OP_XOR, OP_SLT, OP_SLTI,
+    OP_JAL, OP_JALR, OP_JR, OP_J, OP_B,
+    OP_BEQZ, OP_BNEZ, OP_BEQ, OP_BNE, OP_BLT, OP_BLE, OP_BGT, OP_BGE,
+    OP_LB, OP_SB, OP_SYSCALL, OP_NOP
+};
+
+struct Operand {
+    enum Kind { NONE, REG, IMM, MEM, LABEL } kind;
+    int reg;
+    int imm;
+    std::string label;
+    Operand() : kind(NONE), reg(0), imm(0) {}
+};
+
+//
+// Thrown to stop the simulation, with the exit status of the program.
+//
+struct Halt {
+    int status;
+    explicit Halt(int s) : status(s) {}
+};
+
+struct Insn {
+    Opcode op;
+    Operand a, b, c;
+    int line;
+};
+
+//
+// Static cost of each opcode in the cycle model.  Loads and stores pay a
+// cache-hit latency, multiply and divide pay their functional unit
+// latency and taken branches pay a pipeline refill.
+//
+static int insn_cycles(Opcode op) {
+    switch (op) {
+    case OP_LW:
+    case OP_SW:
+    case OP_LB:
+    case OP_SB:
+        return 2;
+    case OP_MUL:
+        return 4;
+    case OP_DIV:
+        return 12;
+    default:
+        return 1;
+    }
+}
+#define TAKEN_BRANCH_CYCLES 1
+
+static const char* reg_names[] = {
+    "$zero", "$at", "$v0", "$v1", "$a0", "$a1", "$a2", "$a3",
+    "$t0", "$t1", "$t2", "$t3", "$t4", "$t5", "$t6", "$t7",
+    "$s0", "$s1", "$s2", "$s3", "$s4", "$s5", "$s6", "$s7",
+    "$t8", "$t9", "$k0", "$k1", "$gp", "$sp", "$fp", "$ra"
+};
+enum { R_ZERO = 0, R_V0 = 2, R_A0 = 4, R_A1 = 5, R_A2 = 6, R_A3 = 7, R_T0 = 8, R_T1 = 9, R_T2 = 10,
+       R_S0 = 16, R_S7 = 23, R_GP = 28, R_SP = 29, R_FP = 30, R_RA = 31 };
+
+class Simulator {
+public:
+    Simulator() : m_heap_ptr(0), m_heap_limit(0), m_pc(0), m_gengc(false), m_gc_test(false),
+                  m_young_start(0) {
+        memset(m_regs, 0, sizeof(m_regs));
+        memset(&m_stats, 0, sizeof(m_stats));
+    }
+
+    bool Load(const char* filename);
+    int Run();
+    void PrintProfile(std::ostream& s, int top);
+    void PrintCounters(std::ostream& s);
+    bool WriteReceivers(const char* filename);
+
+private:
+    // assembler
+    bool ParseLine(const std::string& line, int lineno);
+    bool ParseOperand(const std::string& tok, Operand& op);
+    void ParseAscii(const std::string& rest);
+    void Resolve();
+    void IndexText();
+    int LookUpLabel(const std::string& label, int lineno);
+
+    // memory
+    unsigned char* Addr(int addr, int len);
+    int LoadWord(int addr) { int v; memcpy(&v, Addr(addr, 4), 4); return v; }
+    void StoreWord(int addr, int v) { memcpy(Addr(addr, 4), &v, 4); }
+    int Allocate(int bytes);
+    void GrowHeap(int end);
+    void Collect(int* root);
+
+    // execution
+    void Call(int target);
+    void Step();
+    bool RunRuntime(int addr);
+    void Syscall();
+    void Fatal(const std::string& msg);
+
+    // counters of cgen -P, in the order of ProfileKind in cgen.h
+    enum CounterKind { COUNT_CALLS, COUNT_NEWS, COUNT_RECEIVERS };
+    struct Counter {
+        long long count;
+        std::string name;
+        CounterKind kind;
+        std::string class_name;
+    };
+    std::vector<Counter> GetCounters();
+
+    // runtime routines
+    int CopyObject(int obj);
+    int NewString(const std::string& str);
+    int NewInt(int val);
+    std::string StringOf(int obj);
+    int ClassNameOf(int obj);
+
+    std::vector<Insn> m_text;
+    std::vector<int> m_text_lines;
+    std::vector<unsigned char> m_data;
+    std::vector<unsigned char> m_heap;
+    std::vector<unsigned char> m_stack;
+    std::map<std::string, int> m_labels;
+    std::map<int, std::string> m_label_names;
+    std::vector<std::pair<int, std::string> > m_data_fixups;
+    std::map<int, std::string> m_runtime_names;
+    bool m_in_text;
+
+    int m_regs[32];
+    int m_heap_ptr;
+    int m_heap_limit;
+    int m_pc;
+
+    // The generational collector of cgen -g (-t: m_gc_test). Objects
+    // from m_young_start up to $gp are young; m_assigned holds the
+    // fields recorded by _GenGC_Assign since the last collection.
+    bool m_gengc;
+    bool m_gc_test;
+    int m_young_start;
+    std::vector<int> m_assigned;
+
+    struct {
+        long long insns;
+        long long cycles;
+        long long loads;
+        long long stores;
+        long long branches;
+        long long taken;
+        long long calls;
+        long long runtime_calls;
+        long long allocs;
+        long long alloc_bytes;
+        long long slow_allocs;
+        long long gc_assigns;
+        long long collections;
+        long long copied_bytes;
+        long long console_writes;
+    } m_stats;
+    std::map<int, long long> m_call_hits;
+
+    // Per instruction: the label it starts, if any, and the method it
+    // belongs to, as indices into the counts below.
+    std::vector<int> m_insn_label;
+    std::vector<int> m_insn_method;
+    std::vector<std::string> m_text_labels;
+    std::vector<long long> m_label_hits;
+    std::vector<std::string> m_methods;
+    std::vector<long long> m_method_insns;
+};
+
+static const char* runtime_routines[] = {
+    "Object.copy", "Object.abort", "Object.type_name",
+    "IO.out_string", "IO.out_int", "IO.in_string", "IO.in_int",
+    "String.length", "String.concat", "String.substr",
+    "equality_test", "_dispatch_abort", "_case_abort", "_case_abort2",
+    "_MemMgr_Alloc", "_MemMgr_Test", "_GenGC_Assign", "_gc_check",
+    "_NoGC_Init", "_NoGC_Collect", "_GenGC_Init", "_GenGC_Collect",
+    "_ScnGC_Init", "_ScnGC_Collect",
+    nullptr
+};
+
+void Simulator::Fatal(const std::string& msg) {
+    cout.flush();
+    cerr << "mipsim: " << msg << endl;
+    throw Halt(1);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Assembler
+//
+//////////////////////////////////////////////////////////////////////////////
+
+bool Simulator::Load(const char* filename) {
+    std::ifstream in(filename);
+    if (!in) {
+        cerr << "mipsim: cannot open " << filename << endl;
+        return false;
+    }
+
+    for (int i = 0; runtime_routines[i] != nullptr; ++i) {
+        int addr = RUNTIME_BASE + 4 * i;
+        m_labels[runtime_routines[i]] = addr;
+        m_runtime_names[addr] = runtime_routines[i];
+    }
+
+    m_in_text = false;
+    std::string line;
+    int lineno = 0;
+    while (std::getline(in, line)) {
+        ++lineno;
+        if (!ParseLine(line, lineno)) {
+            return false;
+        }
+    }
+    Resolve();
+    IndexText();
+    return true;
+}
+
+//
+// Split a line on whitespace and commas, keeping quoted strings intact
+// and dropping comments.
+//
+static std::vector<std::string> Tokenize(const std::string& line) {
+    std::vector<std::string> toks;
+    std::string cur;
+    for (size_t i = 0; i < line.size(); ++i) {
+        char c = line[i];
+        if (c == '#') {
+            break;
+        }
+        if (c == ' ' || c == '\t' || c == ',') {
+            if (!cur.empty()) {
+                toks.push_back(cur);
+                cur.clear();
+            }
+            continue;
+        }
+        cur += c;
+    }
+    if (!cur.empty()) {
+        toks.push_back(cur);
+    }
+    return toks;
+}
+
+bool Simulator::ParseOperand(const std::string& tok, Operand& op) {
+    if (tok[0] == '$') {
+        for (int i = 0; i < 32; ++i) {
+            if (tok == reg_names[i]) {
+                op.kind = Operand::REG;
+                op.reg = i;
+                return true;
+            }
+        }
+        return false;
+    }
+    size_t paren = tok.find('(');
+    if (paren != std::string::npos) {
+        Operand base;
+        if (!ParseOperand(tok.substr(paren + 1, tok.size() - paren - 2), base)) {
+            return false;
+        }
+        op.kind = Operand::MEM;
+        op.reg = base.reg;
+        op.imm = paren == 0 ? 0 : atoi(tok.substr(0, paren).c_str());
+        return true;
+    }
+    if (isdigit(tok[0]) || tok[0] == '-') {
+        op.kind = Operand::IMM;
+        op.imm = (int)strtol(tok.c_str(), nullptr, 0);
+        return true;
+    }
+    op.kind = Operand::LABEL;
+    op.label = tok;
+    return true;
+}
+
+void Simulator::ParseAscii(const std::string& rest) {
+    size_t i = rest.find('"') + 1;
+    while (i < rest.size() && rest[i] != '"') {
+        char c = rest[i++];
+        if (c == '\\') {
+            char e = rest[i++];
+            switch (e) {
+            case 'n': c = '\n'; break;
+            case 't': c = '\t'; break;
+            default: c = e; break;
+            }
+        }
+        m_data.push_back(c);
+    }
+}
+
+bool Simulator::ParseLine(const std::string& raw, int lineno) {
+    std::string line = raw;
+    size_t first = line.find_first_not_of(" \t");
+    if (first == std::string::npos || line[first] == '#') {
+        return true;
+    }
+
+    // .ascii keeps its quoted payload verbatim.
+    size_t ascii = line.find(".ascii");
+    if (ascii != std::string::npos && ascii == first) {
+        ParseAscii(line.substr(ascii));
+        return true;
+    }
+
+    std::vector<std::string> toks = Tokenize(line);
+    if (toks.empty()) {
+        return true;
+    }
+
+    // Labels.
+    while (!toks.empty() && toks[0][toks[0].size() - 1] == ':') {
+        std::string label = toks[0].substr(0, toks[0].size() - 1);
+        int addr = m_in_text ? TEXT_BASE + 4 * (int)m_text.size()
+                             : DATA_BASE + (int)m_data.size();
+        m_labels[label] = addr;
+        m_label_names[addr] = label;
+        toks.erase(toks.begin());
+    }
+    if (toks.empty()) {
+        return true;
+    }
+
+    const std::string& mnem = toks[0];
+    if (mnem[0] == '.') {
+        if (mnem == ".text") {
+            m_in_text = true;
+        } else if (mnem == ".data") {
+            m_in_text = false;
+        } else if (mnem == ".align") {
+            int align = 1 << atoi(toks[1].c_str());
+            while (m_data.size() % align) {
+                m_data.push_back(0);
+            }
+        } else if (mnem == ".word") {
+            for (size_t i = 1; i < toks.size(); ++i) {
+                int val = 0;
+                if (isdigit(toks[i][0]) || toks[i][0] == '-') {
+                    val = (int)strtol(toks[i].c_str(), nullptr, 0);
+                } else {
+                    m_data_fixups.push_back(std::make_pair((int)m_data.size(), toks[i]));
+                }
+                for (int b = 0; b < 4; ++b) {
+                    m_data.push_back((val >> (8 * b)) & 0xff);
+                }
+            }
+        } else if (mnem == ".byte") {
+            for (size_t i = 1; i < toks.size(); ++i) {
+                m_data.push_back((unsigned char)atoi(toks[i].c_str()));
+            }
+        } else if (mnem == ".space") {
+            m_data.resize(m_data.size() + atoi(toks[1].c_str()), 0);
+        }
+        // .globl and anything else is ignored.
+        return true;
+    }
+
+    static const std::map<std::string, Opcode> opcodes = {
+        {"lw", OP_LW}, {"sw", OP_SW}, {"li", OP_LI}, {"la", OP_LA},
+        {"move", OP_MOVE}, {"neg", OP_NEG}, {"add", OP_ADD}, {"addi", OP_ADDI},
+        {"addu", OP_ADDU}, {"addiu", OP_ADDIU}, {"sub", OP_SUB}, {"subu", OP_SUBU},
+        {"mul", OP_MUL}, {"div", OP_DIV}, {"sll", OP_SLL}, {"srl", OP_SRL},
+        {"sra", OP_SRA}, {"and", OP_AND}, {"or", OP_OR}, {"xor", OP_XOR},
+        {"slt", OP_SLT}, {"slti", OP_SLTI},
+        {"jal", OP_JAL}, {"jalr", OP_JALR}, {"jr", OP_JR}, {"j", OP_J}, {"b", OP_B},
+        {"beqz", OP_BEQZ}, {"bnez", OP_BNEZ}, {"beq", OP_BEQ}, {"bne", OP_BNE},
+        {"blt", OP_BLT}, {"ble", OP_BLE}, {"bgt", OP_BGT}, {"bge", OP_BGE},
+        {"lb", OP_LB}, {"sb", OP_SB}, {"syscall", OP_SYSCALL}, {"nop", OP_NOP}
+    };
+    auto it = opcodes.find(mnem);
+    if (it == opcodes.end()) {
+        cerr << "mipsim: line " << lineno << ": unknown instruction " << mnem << endl;
+        return false;
+    }
+
+    Insn insn;
+    insn.op = it->second;
+    insn.line = lineno;
+    Operand* ops[] = { &insn.a, &insn.b, &insn.c };
+    for (size_t i = 1; i < toks.size() && i <= 3; ++i) {
+        if (!ParseOperand(toks[i], *ops[i - 1])) {
+            cerr << "mipsim: line " << lineno << ": bad operand " << toks[i] << endl;
+            return false;
+        }
+    }
+    m_text.push_back(insn);
+    return true;
+}
+
+int Simulator::LookUpLabel(const std::string& label, int lineno) {
+    auto it = m_labels.find(label);
+    if (it == m_labels.end()) {
+        std::ostringstream msg;
+        msg << "line " << lineno << ": undefined label " << label;
+        Fatal(msg.str());
+    }
+    return it->second;
+}
+
+void Simulator::Resolve() {
+    for (auto& fixup : m_data_fixups) {
+        int val = LookUpLabel(fixup.second, 0);
+        memcpy(&m_data[fixup.first], &val, 4);
+    }
+    for (Insn& insn : m_text) {
+        Operand* ops[] = { &insn.a, &insn.b, &insn.c };
+        for (Operand* op : ops) {
+            if (op->kind == Operand::LABEL) {
+                op->imm = LookUpLabel(op->label, insn.line);
+            }
+        }
+    }
+}
+
+//
+// Methods start at the labels of the inits and methods (see emit.h);
+// the other labels in the text are local to them.
+//
+static bool IsMethodLabel(const std::string& label) {
+    return label.find('.') != std::string::npos ||
+           (label.size() > 5 && label.compare(label.size() - 5, 5, "_init") == 0);
+}
+
+void Simulator::IndexText() {
+    m_insn_label.assign(m_text.size(), -1);
+    m_insn_method.assign(m_text.size(), 0);
+    m_methods.push_back("?");
+    for (size_t idx = 0; idx < m_text.size(); ++idx) {
+        auto it = m_label_names.find(TEXT_BASE + 4 * idx);
+        if (it != m_label_names.end()) {
+            m_insn_label[idx] = m_text_labels.size();
+            m_text_labels.push_back(it->second);
+            if (IsMethodLabel(it->second)) {
+                m_methods.push_back(it->second);
+            }
+        }
+        m_insn_method[idx] = m_methods.size() - 1;
+    }
+    m_label_hits.assign(m_text_labels.size(), 0);
+    m_method_insns.assign(m_methods.size(), 0);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Memory
+//
+//////////////////////////////////////////////////////////////////////////////
+
+unsigned char* Simulator::Addr(int addr, int len) {
+    unsigned int a = (unsigned int)addr;
+    if (a >= DATA_BASE && a + len <= DATA_BASE + m_data.size()) {
+        return &m_data[a - DATA_BASE];
+    }
+    unsigned int heap_base = DATA_BASE + m_data.size();
+    if (a >= heap_base && a + len <= heap_base + m_heap.size()) {
+        return &m_heap[a - heap_base];
+    }
+    unsigned int stack_base = STACK_TOP + 4 - STACK_SIZE;
+    if (a >= stack_base && a + len <= STACK_TOP + 4) {
+        return &m_stack[a - stack_base];
+    }
+    std::ostringstream msg;
+    msg << "bad address 0x" << std::hex << a << std::dec;
+    if (m_pc >= TEXT_BASE && (m_pc - TEXT_BASE) / 4 < (int)m_text.size()) {
+        msg << " at line " << m_text[(m_pc - TEXT_BASE) / 4].line;
+    }
+    Fatal(msg.str());
+    return nullptr;
+}
+
+//
+// Makes the heap reach up to end, which must not exceed m_heap_limit.
+//
+void Simulator::GrowHeap(int end) {
+    size_t need = (unsigned int)end - (DATA_BASE + m_data.size());
+    if (need > m_heap.size()) {
+        m_heap.resize(std::max(need, 2 * m_heap.size()), 0);
+    }
+}
+
+//
+// Bump allocation from the heap; returns the address of the block.
+//
+int Simulator::Allocate(int bytes) {
+    if (m_regs[R_GP] + bytes > m_heap_limit) {
+        Fatal("out of heap memory");
+    }
+    GrowHeap(m_regs[R_GP] + bytes);
+    int block = m_regs[R_GP];
+    m_regs[R_GP] += bytes;
+    ++m_stats.allocs;
+    m_stats.alloc_bytes += bytes;
+    return block;
+}
+
+//
+// A minor collection. Every young object that a root may point to is
+// copied to the top of the heap, where it is old, and the roots are
+// updated. Words on the stack are roots if they hold the address of a
+// young object, as in the trap handler, which scans the stack the same
+// way. The young generation is then filled with POISON.
+//
+#define POISON 0xdeadbee0
+
+void Simulator::Collect(int* root) {
+    int young_end = m_regs[R_GP];
+    std::vector<int> young;
+    for (int block = m_young_start; block < young_end; ) {
+        young.push_back(block + 4);
+        block += 4 + 4 * LoadWord(block + 4 + SIZE_OFFSET);
+    }
+
+    std::map<int, int> copies;
+    auto forward = [&](int obj) {
+        if (obj < m_young_start || obj >= young_end ||
+            !std::binary_search(young.begin(), young.end(), obj)) {
+            return obj;
+        }
+        auto it = copies.find(obj);
+        if (it != copies.end()) {
+            return it->second;
+        }
+        int bytes = 4 * LoadWord(obj + SIZE_OFFSET);
+        int block = m_regs[R_GP];
+        if (block + bytes + 4 > m_heap_limit) {
+            Fatal("out of heap memory");
+        }
+        GrowHeap(block + bytes + 4);
+        m_regs[R_GP] += bytes + 4;
+        m_stats.copied_bytes += bytes + 4;
+        StoreWord(block, -1);
+        memcpy(Addr(block + 4, bytes), Addr(obj, bytes), bytes);
+        copies[obj] = block + 4;
+        return block + 4;
+    };
+    auto forward_word = [&](int addr) {
+        StoreWord(addr, forward(LoadWord(addr)));
+    };
+
+    for (int addr = m_regs[R_SP]; addr <= STACK_TOP; addr += 4) {
+        forward_word(addr);
+    }
+    m_regs[R_S0] = forward(m_regs[R_S0]);
+    if (root != nullptr) {
+        *root = forward(*root);
+    }
+    for (int addr : m_assigned) {
+        if (addr < m_young_start || addr >= young_end) {
+            forward_word(addr);
+        }
+    }
+
+    // The fields of the copies, which are copied in turn.
+    int int_tag = LoadWord(LookUpLabel("_int_tag", 0));
+    int bool_tag = LoadWord(LookUpLabel("_bool_tag", 0));
+    int string_tag = LoadWord(LookUpLabel("_string_tag", 0));
+    for (int block = young_end; block < m_regs[R_GP]; ) {
+        int obj = block + 4;
+        int tag = LoadWord(obj + TAG_OFFSET);
+        int end = obj + 4 * LoadWord(obj + SIZE_OFFSET);
+        if (tag == string_tag) {
+            forward_word(obj + STR_LEN_OFFSET);
+        } else if (tag != int_tag && tag != bool_tag) {
+            for (int addr = obj + ATTR_OFFSET; addr < end; addr += 4) {
+                forward_word(addr);
+            }
+        }
+        block = end;
+    }
+
+    for (int addr = m_young_start; addr < young_end; addr += 4) {
+        StoreWord(addr, POISON);
+    }
+    m_young_start = m_regs[R_GP];
+    m_assigned.clear();
+    ++m_stats.collections;
+    m_regs[R_S7] = std::min(m_regs[R_GP] + ALLOC_WINDOW, m_heap_limit);
+    GrowHeap(m_regs[R_S7]);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Runtime system
+//
+//////////////////////////////////////////////////////////////////////////////
+
+int Simulator::CopyObject(int obj) {
+    int words = LoadWord(obj + SIZE_OFFSET);
+    if (words <= 0) {
+        Fatal("Object.copy: Invalid object size");
+    }
+    int block = Allocate(4 * words + 4);
+    StoreWord(block, -1);
+    memcpy(Addr(block + 4, 4 * words), Addr(obj, 4 * words), 4 * words);
+    return block + 4;
+}
+
+int Simulator::NewInt(int val) {
+    int obj = CopyObject(m_labels["Int_protObj"]);
+    StoreWord(obj + ATTR_OFFSET, val);
+    return obj;
+}
+
+int Simulator::NewString(const std::string& str) {
+    int words = 4 + (str.size() + 4) / 4;
+    int block = Allocate(4 * words + 4);
+    int obj = block + 4;
+    int proto = m_labels["String_protObj"];
+    StoreWord(block, -1);
+    StoreWord(obj + TAG_OFFSET, LoadWord(proto + TAG_OFFSET));
+    StoreWord(obj + SIZE_OFFSET, words);
+    StoreWord(obj + DISPTABLE_OFFSET, LoadWord(proto + DISPTABLE_OFFSET));
+    StoreWord(obj + STR_LEN_OFFSET, NewInt(str.size()));
+    unsigned char* chars = Addr(obj + STR_CHARS_OFFSET, str.size() + 1);
+    memcpy(chars, str.data(), str.size());
+    chars[str.size()] = 0;
+    return obj;
+}
+
+std::string Simulator::StringOf(int obj) {
+    int len = LoadWord(LoadWord(obj + STR_LEN_OFFSET) + ATTR_OFFSET);
+    return std::string((char*)Addr(obj + STR_CHARS_OFFSET, len), len);
+}
+
+int Simulator::ClassNameOf(int obj) {
+    int tag = LoadWord(obj + TAG_OFFSET);
+    return LoadWord(m_labels["class_nameTab"] + 4 * tag);
+}
+
+//
+// Execute the runtime routine at addr, if any.  Routines take their
+// receiver in $a0, their arguments on the stack (popped by the callee)
+// and return in $a0, like generated methods.
+//
+bool Simulator::RunRuntime(int addr) {
+    auto it = m_runtime_names.find(addr);
+    if (it == m_runtime_names.end()) {
+        return false;
+    }
+    const std::string& name = it->second;
+    int* r = m_regs;
+    ++m_stats.runtime_calls;
+
+    if (name == "Object.copy") {
+        if (m_gengc && m_gc_test) {
+            Collect(&r[R_A0]);
+        }
+        r[R_A0] = CopyObject(r[R_A0]);
+    } else if (name == "Object.abort") {
+        cout << "Abort called from class " << StringOf(ClassNameOf(r[R_A0])) << endl;
+        throw Halt(0);
+    } else if (name == "Object.type_name") {
+        r[R_A0] = ClassNameOf(r[R_A0]);
+    } else if (name == "IO.out_string") {
+        ++m_stats.console_writes;
+        cout << StringOf(LoadWord(r[R_SP] + 4));
+        r[R_SP] += 4;
+    } else if (name == "IO.out_int") {
+        ++m_stats.console_writes;
+        cout << LoadWord(LoadWord(r[R_SP] + 4) + ATTR_OFFSET);
+        r[R_SP] += 4;
+    } else if (name == "IO.in_string") {
+        std::string line;
+        cout.flush();
+        std::getline(std::cin, line);
+        r[R_A0] = NewString(line);
+    } else if (name == "IO.in_int") {
+        std::string line;
+        cout.flush();
+        std::getline(std::cin, line);
+        r[R_A0] = NewInt(atoi(line.c_str()));
+    } else if (name == "String.length") {
+        r[R_A0] = LoadWord(r[R_A0] + STR_LEN_OFFSET);
+    } else if (name == "String.concat") {
+        std::string rhs = StringOf(LoadWord(r[R_SP] + 4));
+        r[R_SP] += 4;
+        r[R_A0] = NewString(StringOf(r[R_A0]) + rhs);
+    } else if (name == "String.substr") {
+        int len = LoadWord(LoadWord(r[R_SP] + 4) + ATTR_OFFSET);
+        int start = LoadWord(LoadWord(r[R_SP] + 8) + ATTR_OFFSET);
+        r[R_SP] += 8;
+        std::string str = StringOf(r[R_A0]);
+        if (start < 0 || len < 0 || start + len > (int)str.size()) {
+            cout << "Index to substr is out of range" << endl;
+            throw Halt(0);
+        }
+        r[R_A0] = NewString(str.substr(start, len));
+    } else if (name == "equality_test") {
+        int a = r[R_T1], b = r[R_T2];
+        bool equal = a == b;
+        if (!equal && a != 0 && b != 0 && LoadWord(a) == LoadWord(b)) {
+            int tag = LoadWord(a);
+            if (tag == LoadWord(m_labels["_string_tag"])) {
+                equal = StringOf(a) == StringOf(b);
+            } else if (tag == LoadWord(m_labels["_int_tag"]) ||
+                       tag == LoadWord(m_labels["_bool_tag"])) {
+                equal = LoadWord(a + ATTR_OFFSET) == LoadWord(b + ATTR_OFFSET);
+            }
+        }
+        if (!equal) {
+            r[R_A0] = r[R_A1];
+        }
+    } else if (name == "_dispatch_abort") {
+        cout << StringOf(r[R_A0]) << ":" << r[R_T1] << ": Dispatch to void." << endl;
+        throw Halt(0);
+    } else if (name == "_case_abort") {
+        cout << "No match in case statement for Class "
+             << StringOf(ClassNameOf(r[R_A0])) << endl;
+        throw Halt(0);
+    } else if (name == "_case_abort2") {
+        cout << StringOf(r[R_A0]) << ":" << r[R_T1] << ": Match on void in case statement." << endl;
+        throw Halt(0);
+    } else if (name == "_MemMgr_Alloc") {
+        ++m_stats.slow_allocs;
+        if (m_gengc) {
+            Collect(nullptr);
+        }
+        if (r[R_GP] + r[R_A0] >= r[R_S7]) {
+            r[R_S7] = std::min(r[R_GP] + r[R_A0] + ALLOC_WINDOW, m_heap_limit);
+            GrowHeap(r[R_S7]);
+        }
+        r[R_A0] = Allocate(r[R_A0]);
+    } else if (name == "_MemMgr_Test") {
+        if (m_gengc && m_gc_test) {
+            Collect(nullptr);
+        }
+    } else if (name == "_GenGC_Collect") {
+        if (m_gengc) {
+            Collect(nullptr);
+        }
+    } else if (name == "_GenGC_Assign") {
+        ++m_stats.gc_assigns;
+        if (m_gengc) {
+            m_assigned.push_back(r[R_A1]);
+        }
+    } else if (name == "_gc_check") {
+        if (r[R_A1] != 0 && LoadWord(r[R_A1] - 4) != -1) {
+            Fatal("_gc_check: bad object");
+        }
+    }
+    // Only the generational collector is modeled; with the others the
+    // simulated heap grows, up to HEAP_MAX.
+
+    // Like the trap handler, the runtime only preserves $s*, $fp, $sp and
+    // $ra; scribble over the temporaries so that generated code cannot
+    // come to depend on them surviving a call.
+    if (name != "_GenGC_Assign" && name != "_gc_check") {
+        static const int clobbered[] = { 2, 3, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 24, 25 };
+        for (int reg : clobbered) {
+            r[reg] = 0x0badf00d;
+        }
+        if (name != "equality_test") {
+            r[R_A1] = 0x0badf00d;
+        }
+    } else {
+        r[R_A1] = 0x0badf00d;
+    }
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Execution
+//
+//////////////////////////////////////////////////////////////////////////////
+
+void Simulator::Call(int target) {
+    m_regs[R_RA] = HALT_ADDR;
+    m_pc = target;
+    while (m_pc != HALT_ADDR) {
+        Step();
+    }
+}
+
+void Simulator::Step() {
+    if (m_pc < TEXT_BASE && RunRuntime(m_pc)) {
+        m_pc = m_regs[R_RA];
+        return;
+    }
+    unsigned int idx = (unsigned int)(m_pc - TEXT_BASE) / 4;
+    if (m_pc < TEXT_BASE || idx >= m_text.size()) {
+        std::ostringstream msg;
+        msg << "jump to bad address 0x" << std::hex << m_pc;
+        Fatal(msg.str());
+    }
+    if (m_insn_label[idx] != -1) {
+        ++m_label_hits[m_insn_label[idx]];
+    }
+    ++m_method_insns[m_insn_method[idx]];
+
+    const Insn& in = m_text[idx];
+    int* r = m_regs;
+    int next = m_pc + 4;
+    bool taken = false;
+    auto val = [&](const Operand& op) {
+        return op.kind == Operand::REG ? r[op.reg] : op.imm;
+    };
+
+    ++m_stats.insns;
+    m_stats.cycles += insn_cycles(in.op);
+    switch (in.op) {
+    case OP_LW: ++m_stats.loads; r[in.a.reg] = LoadWord(r[in.b.reg] + in.b.imm); break;
+    case OP_SW: ++m_stats.stores; StoreWord(r[in.b.reg] + in.b.imm, r[in.a.reg]); break;
+    case OP_LI:
+    case OP_LA:
+        if (in.b.kind == Operand::MEM) {
+            r[in.a.reg] = r[in.b.reg] + in.b.imm;
+        } else {
+            r[in.a.reg] = in.b.imm;
+        }
+        break;
+    case OP_MOVE: r[in.a.reg] = r[in.b.reg]; break;
+    case OP_NEG: r[in.a.reg] = -r[in.b.reg]; break;
+    case OP_ADD:
+    case OP_ADDI:
+    case OP_ADDU:
+    case OP_ADDIU: r[in.a.reg] = r[in.b.reg] + val(in.c); break;
+    case OP_SUB:
+    case OP_SUBU: r[in.a.reg] = r[in.b.reg] - val(in.c); break;
+    case OP_MUL: r[in.a.reg] = r[in.b.reg] * val(in.c); break;
+    case OP_DIV:
+        if (val(in.c) == 0) {
+            Fatal("division by zero");
+        }
+        r[in.a.reg] = r[in.b.reg] / val(in.c);
+        break;
+    case OP_SLL: r[in.a.reg] = r[in.b.reg] << val(in.c); break;
+    case OP_SRL: r[in.a.reg] = (unsigned int)r[in.b.reg] >> val(in.c); break;
+    case OP_SRA: r[in.a.reg] = r[in.b.reg] >> val(in.c); break;
+    case OP_AND: r[in.a.reg] = r[in.b.reg] & val(in.c); break;
+    case OP_OR: r[in.a.reg] = r[in.b.reg] | val(in.c); break;
+    case OP_XOR: r[in.a.reg] = r[in.b.reg] ^ val(in.c); break;
+    case OP_SLT:
+    case OP_SLTI: r[in.a.reg] = r[in.b.reg] < val(in.c); break;
+    case OP_JAL:
+        ++m_stats.calls;
+        ++m_call_hits[in.a.imm];
+        r[R_RA] = next;
+        next = in.a.imm;
+        break;
+    case OP_JALR:
+        ++m_stats.calls;
+        ++m_call_hits[r[in.a.reg]];
+        next = r[in.a.reg];
+        r[R_RA] = m_pc + 4;
+        break;
+    case OP_JR: next = r[in.a.reg]; break;
+    case OP_J:
+    case OP_B: next = in.a.imm; break;
+    case OP_BEQZ: taken = r[in.a.reg] == 0; if (taken) next = in.b.imm; break;
+    case OP_BNEZ: taken = r[in.a.reg] != 0; if (taken) next = in.b.imm; break;
+    case OP_BEQ: taken = r[in.a.reg] == val(in.b); if (taken) next = in.c.imm; break;
+    case OP_BNE: taken = r[in.a.reg] != val(in.b); if (taken) next = in.c.imm; break;
+    case OP_BLT: taken = r[in.a.reg] < val(in.b); if (taken) next = in.c.imm; break;
+    case OP_BLE: taken = r[in.a.reg] <= val(in.b); if (taken) next = in.c.imm; break;
+    case OP_BGT: taken = r[in.a.reg] > val(in.b); if (taken) next = in.c.imm; break;
+    case OP_BGE: taken = r[in.a.reg] >= val(in.b); if (taken) next = in.c.imm; break;
+    case OP_LB:
+        ++m_stats.loads;
+        r[in.a.reg] = (signed char)*Addr(r[in.b.reg] + in.b.imm, 1);
+        break;
+    case OP_SB:
+        ++m_stats.stores;
+        *Addr(r[in.b.reg] + in.b.imm, 1) = r[in.a.reg];
+        break;
+    case OP_SYSCALL: Syscall(); break;
+    case OP_NOP: break;
+    }
+    if (in.op >= OP_BEQZ && in.op <= OP_BGE) {
+        ++m_stats.branches;
+        if (taken) {
+            ++m_stats.taken;
+            m_stats.cycles += TAKEN_BRANCH_CYCLES;
+        }
+    }
+    r[R_ZERO] = 0;
+    m_pc = next;
+}
+
+//
+// The SPIM syscalls that print, selected by $v0, and exit. Each print
+// is a write to the console, which SPIM makes at once.
+//
+void Simulator::Syscall() {
+    int* r = m_regs;
+    switch (r[R_V0]) {
+    case 1:
+        ++m_stats.console_writes;
+        cout << r[R_A0];
+        break;
+    case 4:
+        ++m_stats.console_writes;
+        for (int addr = r[R_A0]; *Addr(addr, 1) != 0; ++addr) {
+            cout << (char)*Addr(addr, 1);
+        }
+        break;
+    case 10:
+        throw Halt(0);
+    case 11:
+        ++m_stats.console_writes;
+        cout << (char)r[R_A0];
+        break;
+    default: {
+        std::ostringstream msg;
+        msg << "unsupported syscall " << r[R_V0];
+        Fatal(msg.str());
+    }
+    }
+}
+
+//
+// The equivalent of the trap handler's __start: set up the heap, build
+// Main, run Main.main.
+//
+int Simulator::Run() {
+    m_stack.assign(STACK_SIZE, 0);
+    m_heap.assign(HEAP_SIZE, 0);
+    m_regs[R_SP] = STACK_TOP;
+    m_regs[R_FP] = STACK_TOP;
+    m_regs[R_GP] = DATA_BASE + m_data.size();
+    m_heap_limit = m_regs[R_GP] + HEAP_MAX;
+    // $s7 is the limit of the current allocation window; _MemMgr_Alloc
+    // moves it when generated code runs out of room, like a collection.
+    m_regs[R_S7] = m_regs[R_GP] + ALLOC_WINDOW;
+    m_young_start = m_regs[R_GP];
+    m_gengc = LoadWord(LookUpLabel("_MemMgr_COLLECTOR", 0)) == LookUpLabel("_GenGC_Collect", 0);
+    m_gc_test = LoadWord(LookUpLabel("_MemMgr_TEST", 0)) != 0;
+
+    try {
+        m_regs[R_A0] = CopyObject(LookUpLabel("Main_protObj", 0));
+        Call(LookUpLabel("Main_init", 0));
+        Call(LookUpLabel("Main.main", 0));
+    } catch (const Halt& halt) {
+        cout.flush();
+        PrintCounters(cerr);
+        return halt.status;
+    }
+    cout.flush();
+    cerr << "COOL program successfully executed" << endl;
+    PrintCounters(cerr);
+    return 0;
+}
+
+//
+// The counters of cgen -P, with what each counts (see
+// code_profile_tables). Empty if the program has none.
+//
+std::vector<Simulator::Counter> Simulator::GetCounters() {
+    std::vector<Counter> counters;
+    if (m_labels.count("_prof_num") == 0) {
+        return counters;
+    }
+    int num = LoadWord(m_labels["_prof_num"]);
+    int counts = m_labels["_prof_counts"];
+    int names = m_labels["_prof_names"];
+    int kinds = m_labels["_prof_kinds"];
+    int tags = m_labels["_prof_tags"];
+    for (int i = 0; i < num; ++i) {
+        Counter counter;
+        counter.count = LoadWord(counts + 4 * i);
+        counter.name = (char*)Addr(LoadWord(names + 4 * i), 1);
+        counter.kind = (CounterKind)LoadWord(kinds + 4 * i);
+        int tag = LoadWord(tags + 4 * i);
+        counter.class_name = tag == -1 ? "SELF_TYPE"
+                                       : StringOf(LoadWord(m_labels["class_nameTab"] + 4 * tag));
+        counters.push_back(counter);
+    }
+    return counters;
+}
+
+//
+// The exit hook for cgen -P: the counters, busiest first.
+//
+void Simulator::PrintCounters(std::ostream& s) {
+    std::vector<std::pair<long long, std::string> > calls;
+    std::vector<std::pair<long long, std::string> > sites;
+    std::vector<std::pair<long long, std::string> > receivers;
+    std::map<std::string, long long> classes;
+    std::vector<Counter> counters = GetCounters();
+    if (counters.empty()) {
+        return;
+    }
+    for (const Counter& counter : counters) {
+        if (counter.count == 0) {
+            continue;
+        }
+        switch (counter.kind) {
+        case COUNT_CALLS:
+            calls.push_back(std::make_pair(-counter.count, counter.name));
+            break;
+        case COUNT_NEWS:
+            sites.push_back(std::make_pair(-counter.count, counter.name));
+            classes[counter.class_name] += counter.count;
+            break;
+        case COUNT_RECEIVERS:
+            receivers.push_back(std::make_pair(-counter.count, counter.name + ": " + counter.class_name));
+            break;
+        }
+    }
+
+    std::vector<std::pair<long long, std::string> > by_class;
+    for (auto& c : classes) {
+        by_class.push_back(std::make_pair(-c.second, c.first));
+    }
+    auto print = [&](const char* title, std::vector<std::pair<long long, std::string> >& counts) {
+        std::sort(counts.begin(), counts.end());
+        s << title << endl;
+        for (auto& count : counts) {
+            s << "\t" << -count.first << "\t" << count.second << endl;
+        }
+    };
+    print("Calls:", calls);
+    print("Allocations by site:", sites);
+    print("Allocations by class:", by_class);
+    print("Receivers by dispatch site:", receivers);
+}
+
+//
+// Writes the receivers counted at each dispatch site by cgen -P, in the
+// form cgen -F reads: the site, then each class and its number of calls.
+//
+bool Simulator::WriteReceivers(const char* filename) {
+    std::ofstream out(filename);
+    if (!out) {
+        cerr << "mipsim: cannot open " << filename << endl;
+        return false;
+    }
+    std::vector<std::string> sites;
+    std::map<std::string, std::string> receivers;
+    for (const Counter& counter : GetCounters()) {
+        if (counter.kind != COUNT_RECEIVERS || counter.count == 0) {
+            continue;
+        }
+        if (receivers.count(counter.name) == 0) {
+            sites.push_back(counter.name);
+        }
+        std::ostringstream receiver;
+        receiver << " " << counter.class_name << " " << counter.count;
+        receivers[counter.name] += receiver.str();
+    }
+    for (const std::string& site : sites) {
+        out << site << receivers[site] << endl;
+    }
+    return true;
+}
+
+void Simulator::PrintProfile(std::ostream& s, int top) {
+    s << "Stats -- #instructions : " << m_stats.insns << endl
+      << "         #cycles       : " << m_stats.cycles << endl
+      << "         #reads        : " << m_stats.loads << endl
+      << "         #writes       : " << m_stats.stores << endl
+      << "         #branches     : " << m_stats.branches
+      << " (" << m_stats.taken << " taken)" << endl
+      << "         #calls        : " << m_stats.calls
+      << " (" << m_stats.runtime_calls << " into the runtime)" << endl
+      << "         #allocations  : " << m_stats.allocs
+      << " (" << m_stats.alloc_bytes << " bytes, " << m_stats.slow_allocs << " via _MemMgr_Alloc)" << endl
+      << "         #gc assigns   : " << m_stats.gc_assigns << endl
+      << "         #collections  : " << m_stats.collections
+      << " (" << m_stats.copied_bytes << " bytes copied)" << endl
+      << "         #prints       : " << m_stats.console_writes << endl;
+
+    auto print_top = [&](const char* title, const std::vector<long long>& counts,
+                         const std::vector<std::string>& names) {
+        std::vector<std::pair<long long, int> > sorted;
+        for (size_t i = 0; i < counts.size(); ++i) {
+            if (counts[i] != 0) {
+                sorted.push_back(std::make_pair(-counts[i], (int)i));
+            }
+        }
+        std::sort(sorted.begin(), sorted.end());
+        s << title << endl;
+        for (int i = 0; i < (int)sorted.size() && i < top; ++i) {
+            s << "\t" << -sorted[i].first << "\t" << names[sorted[i].second] << endl;
+        }
+    };
+    print_top("Hottest labels:", m_label_hits, m_text_labels);
+    print_top("Hottest methods (instructions):", m_method_insns, m_methods);
+
+    std::vector<long long> calls;
+    std::vector<std::string> callees;
+    for (auto& hit : m_call_hits) {
+        calls.push_back(hit.second);
+        if (m_label_names.count(hit.first)) {
+            callees.push_back(m_label_names[hit.first]);
+        } else if (m_runtime_names.count(hit.first)) {
+            callees.push_back(m_runtime_names[hit.first]);
+        } else {
+            callees.push_back("?");
+        }
+    }
+    print_top("Most called:", calls, callees);
+}
+
+int main(int argc, char* argv[]) {
+    int c;
+    bool profile = false;
+    int top = 10;
+    const char* receivers_file = nullptr;
+    while ((c = getopt(argc, argv, "pn:d:")) != -1) {
+        switch (c) {
+        case 'p':
+            profile = true;
+            break;
+        case 'n':
+            top = atoi(optarg);
+            break;
+        case 'd':
+            receivers_file = optarg;
+            break;
+        default:
+            cerr << "usage: " << argv[0] << " [-p] [-n top] [-d file] file.s" << endl;
+            return 1;
+        }
+    }
+    if (optind >= argc) {
+        cerr << "usage: " << argv[0] << " [-p] [-n top] [-d file] file.s" << endl;
+        return 1;
+    }
+
+    Simulator sim;
+    if (!sim.Load(argv[optind])) {
+        return 1;
+    }
+    int ret = sim.Run();
+    if (profile) {
+        sim.PrintProfile(cerr, top);
+    }
+    if (receivers_file != nullptr && !sim.WriteReceivers(receivers_file)) {
+        return 1;
+    }
+    return ret;
+}
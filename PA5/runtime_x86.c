@@ -0,0 +1,228 @@
+/*
+ * Runtime for the x86-64 backend (cgen -x).
+ *
+ * Link with the generated assembly:
+ *
+ *    gcc prog.s runtime_x86.c -o prog
+ *
+ * Provides the basic methods of Object, IO and String, allocation and
+ * the abort routines, with the messages of the MIPS runtime. Objects
+ * are laid out as described in emit_x86.h. Memory is bump allocated
+ * from large chunks and never collected.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct Object {
+    long tag;
+    long size;              /* in words, header included */
+    void** disp;
+    struct Object* attrs[];
+} Object;
+
+typedef struct Int {
+    long tag;
+    long size;
+    void** disp;
+    long val;               /* the low 32 bits hold the value */
+} Int;
+
+typedef struct String {
+    long tag;
+    long size;
+    void** disp;
+    Int* len;
+    char chars[];           /* NUL terminated */
+} String;
+
+#define WORD_SIZE 8
+#define CHUNK_SIZE (1 << 22)
+
+/* From the generated code. */
+extern Object* cool_main(void);
+extern Int Int_protObj;
+extern String String_protObj;
+extern String* class_nameTab[];
+extern long _int_tag;
+extern long _bool_tag;
+extern long _string_tag;
+
+static char* heap_ptr;
+static char* heap_limit;
+
+static void* cool_alloc(long bytes) {
+    if (bytes > heap_limit - heap_ptr) {
+        long chunk = bytes > CHUNK_SIZE ? bytes : CHUNK_SIZE;
+        heap_ptr = malloc(chunk);
+        if (heap_ptr == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        heap_limit = heap_ptr + chunk;
+    }
+    void* ret = heap_ptr;
+    heap_ptr += bytes;
+    return ret;
+}
+
+static void cool_halt(void) {
+    fflush(stdout);
+    exit(0);
+}
+
+Object* cool_copy(Object* obj) {
+    long bytes = obj->size * WORD_SIZE;
+    Object* ret = cool_alloc(bytes);
+    memcpy(ret, obj, bytes);
+    return ret;
+}
+
+Int* cool_new_int(int val) {
+    Int* ret = (Int*)cool_copy((Object*)&Int_protObj);
+    ret->val = val;
+    return ret;
+}
+
+static String* cool_new_string(const char* chars, long len) {
+    long size = 4 + (len + WORD_SIZE) / WORD_SIZE;
+    String* ret = cool_alloc(size * WORD_SIZE);
+    memcpy(ret, &String_protObj, sizeof(String));
+    ret->size = size;
+    ret->len = cool_new_int(len);
+    memcpy(ret->chars, chars, len);
+    ret->chars[len] = '\0';
+    return ret;
+}
+
+static int cool_string_len(String* str) {
+    return (int)str->len->val;
+}
+
+/* Reads a line without its newline. */
+static char* cool_read_line(long* len) {
+    static char* line = NULL;
+    static size_t cap = 0;
+    fflush(stdout);
+    ssize_t n = getline(&line, &cap, stdin);
+    if (n <= 0) {
+        *len = 0;
+        return "";
+    }
+    if (line[n - 1] == '\n') {
+        line[--n] = '\0';
+    }
+    *len = n;
+    return line;
+}
+
+/*
+ * Basic methods
+ */
+
+Object* cool_Object_abort(Object* self) {
+    printf("Abort called from class %s\n", class_nameTab[self->tag]->chars);
+    cool_halt();
+    return self;
+}
+
+String* cool_Object_type_name(Object* self) {
+    return class_nameTab[self->tag];
+}
+
+Object* cool_Object_copy(Object* self) {
+    return cool_copy(self);
+}
+
+Object* cool_IO_out_string(Object* self, String* str) {
+    fwrite(str->chars, 1, cool_string_len(str), stdout);
+    return self;
+}
+
+Object* cool_IO_out_int(Object* self, Int* i) {
+    printf("%d", (int)i->val);
+    return self;
+}
+
+String* cool_IO_in_string(Object* self) {
+    long len;
+    char* line = cool_read_line(&len);
+    return cool_new_string(line, len);
+}
+
+Int* cool_IO_in_int(Object* self) {
+    long len;
+    return cool_new_int(atoi(cool_read_line(&len)));
+}
+
+Int* cool_String_length(String* self) {
+    return self->len;
+}
+
+String* cool_String_concat(String* self, String* str) {
+    int len = cool_string_len(self);
+    int str_len = cool_string_len(str);
+    String* ret = cool_new_string(self->chars, len + str_len);
+    memcpy(ret->chars + len, str->chars, str_len);
+    return ret;
+}
+
+String* cool_String_substr(String* self, Int* start, Int* len) {
+    int i = (int)start->val;
+    int l = (int)len->val;
+    if (i < 0 || l < 0 || i + l > cool_string_len(self)) {
+        printf("Index to substr is out of range\n");
+        cool_halt();
+    }
+    return cool_new_string(self->chars + i, l);
+}
+
+/*
+ * Equality of distinct objects: only Ints, Bools and Strings with the
+ * same value are equal.
+ */
+long cool_equality_test(Object* a, Object* b) {
+    if (a == NULL || b == NULL || a->tag != b->tag) {
+        return 0;
+    }
+    if (a->tag == _int_tag || a->tag == _bool_tag) {
+        return (int)((Int*)a)->val == (int)((Int*)b)->val;
+    }
+    if (a->tag == _string_tag) {
+        String* s = (String*)a;
+        String* t = (String*)b;
+        return cool_string_len(s) == cool_string_len(t) &&
+               memcmp(s->chars, t->chars, cool_string_len(s)) == 0;
+    }
+    return 0;
+}
+
+/*
+ * Aborts
+ */
+
+void cool_dispatch_abort(String* filename, int line) {
+    printf("%s:%d: Dispatch to void.\n", filename->chars, line);
+    cool_halt();
+}
+
+void cool_case_abort(Object* obj) {
+    printf("No match in case statement for Class %s\n", class_nameTab[obj->tag]->chars);
+    cool_halt();
+}
+
+void cool_case_abort2(String* filename, int line) {
+    printf("%s:%d: Match on void in case statement.\n", filename->chars, line);
+    cool_halt();
+}
+
+int main(void) {
+    /* Fully buffered even on a terminal; flushed before input is read
+     * and when the program ends. */
+    setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+    cool_main();
+    fflush(stdout);
+    fprintf(stderr, "COOL program successfully executed\n");
+    return 0;
+}
@@ -0,0 +1,659 @@
+//**************************************************************
+//
+// Bytecode VM (cgen -b).
+//
+// The code is threaded before it runs: each opcode is replaced by the
+// address of the code that executes it, which ends by jumping straight
+// to the next one. With -B every opcode executed is also counted, and
+// the counts are reported when the program ends.
+//
+// Objects live in a heap collected by copying (Cheney): a word of
+// header, holding the size in words and the class tag, followed by the
+// attributes. A String's single attribute is its length, followed by
+// its chars, NUL terminated. The roots are the stack, the accumulator
+// and the self of every frame. Constant Strings are outside the heap
+// and never move.
+//
+//**************************************************************
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+
+#include "bytecode.h"
+
+static const size_t HEAP_WORDS = 1 << 20;
+static const size_t STACK_VALUES = 1 << 20;
+static const size_t FRAME_NUM = 1 << 18;
+
+static bool IsInt(BcValue v) {
+    return (v & BC_TAG_MASK) == BC_INT_TAG;
+}
+
+static bool IsBool(BcValue v) {
+    return (v & BC_TAG_MASK) == BC_BOOL_TAG;
+}
+
+static bool IsObject(BcValue v) {
+    return v != BC_VOID && (v & BC_TAG_MASK) == 0;
+}
+
+static int32_t IntVal(BcValue v) {
+    return (int32_t)((int64_t)v >> 2);
+}
+
+static BcValue MakeInt(int32_t i) {
+    return ((uint64_t)(int64_t)i << 2) | BC_INT_TAG;
+}
+
+static BcValue MakeBool(bool b) {
+    return ((uint64_t)b << 2) | BC_BOOL_TAG;
+}
+
+static uint64_t* ObjectOf(BcValue v) {
+    return (uint64_t*)v;
+}
+
+static uint64_t MakeHeader(int tag, size_t size) {
+    return ((uint64_t)size << 32) | ((uint64_t)tag << 1);
+}
+
+static size_t SizeOf(const uint64_t* obj) {
+    return obj[0] >> 32;
+}
+
+static int HeaderTag(const uint64_t* obj) {
+    return (obj[0] >> 1) & 0x7fffffff;
+}
+
+static int StringLen(BcValue str) {
+    return IntVal(ObjectOf(str)[1]);
+}
+
+static char* StringChars(BcValue str) {
+    return (char*)(ObjectOf(str) + 2);
+}
+
+static size_t StringSize(int len) {
+    return 2 + (len + 8) / 8;
+}
+
+class BcVm {
+public:
+    BcVm(const BcProgram& program, std::ostream& out, bool count_ops);
+    int Run();
+
+private:
+    struct Frame {
+        const void* const* pc;    // return address, nullptr to end
+        BcValue* fp;
+        BcValue self;
+        int method;
+    };
+
+    template <bool COUNT>
+    int Execute();
+
+    int TagOf(BcValue v) {
+        if (IsInt(v)) {
+            return m_program.int_tag;
+        }
+        if (IsBool(v)) {
+            return m_program.bool_tag;
+        }
+        return HeaderTag(ObjectOf(v));
+    }
+
+    // Allocation may collect, so the values of the registers must be in
+    // m_acc, m_self and m_sp.
+    uint64_t* Allocate(int tag, size_t size);
+    void Collect(size_t need);
+    void CopyLive(size_t size);
+    BcValue Forward(BcValue v);
+    BcValue NewObject(int tag);
+    BcValue NewString(const char* chars, int len);
+    BcValue CopyObject(BcValue obj);
+    bool RunNative(BcNative native, BcValue* args);
+
+    std::string StringOf(BcValue str) {
+        return std::string(StringChars(str), StringLen(str));
+    }
+
+    std::string ClassNameOf(BcValue obj) {
+        return m_program.classes[TagOf(obj)].name;
+    }
+
+    std::string FilenameOf(int method) {
+        return StringOf(m_consts[m_program.methods[method].filename]);
+    }
+
+    void ReportCounts();
+
+    const BcProgram& m_program;
+    std::ostream& m_out;
+    bool m_count_ops;
+
+    std::vector<BcValue> m_consts;
+    std::vector<std::vector<uint64_t>> m_static_strings;
+
+    std::vector<uint64_t> m_heap;
+    std::vector<uint64_t> m_to_space;
+    uint64_t* m_alloc;
+    uint64_t* m_to_alloc;
+    size_t m_collections;
+
+    std::vector<BcValue> m_stack;
+    std::vector<Frame> m_frames;
+    BcValue* m_sp;
+    BcValue m_acc;
+    BcValue m_self;
+
+    uint64_t m_op_counts[BC_OP_NUM];
+};
+
+BcVm::BcVm(const BcProgram& program, std::ostream& out, bool count_ops)
+    : m_program(program), m_out(out), m_count_ops(count_ops), m_collections(0),
+      m_acc(BC_VOID), m_self(BC_VOID) {
+    for (const BcConst& c : program.consts) {
+        if (c.kind == BcConst::INT) {
+            m_consts.push_back(MakeInt(c.val));
+        } else if (c.kind == BcConst::BOOL) {
+            m_consts.push_back(MakeBool(c.val));
+        } else {
+            std::vector<uint64_t> str(StringSize(c.str.size()), 0);
+            str[0] = MakeHeader(program.string_tag, str.size());
+            str[1] = MakeInt(c.str.size());
+            memcpy(&str[2], c.str.data(), c.str.size());
+            m_static_strings.push_back(str);
+            m_consts.push_back((BcValue)&m_static_strings.back()[0]);
+        }
+    }
+
+    m_heap.resize(HEAP_WORDS);
+    m_alloc = &m_heap[0];
+    m_stack.resize(STACK_VALUES);
+    m_sp = &m_stack[0];
+    m_frames.reserve(FRAME_NUM);
+    memset(m_op_counts, 0, sizeof(m_op_counts));
+}
+
+uint64_t* BcVm::Allocate(int tag, size_t size) {
+    if (m_alloc + size > &m_heap[0] + m_heap.size()) {
+        Collect(size);
+    }
+    uint64_t* obj = m_alloc;
+    m_alloc += size;
+    obj[0] = MakeHeader(tag, size);
+    return obj;
+}
+
+BcValue BcVm::Forward(BcValue v) {
+    if (!IsObject(v)) {
+        return v;
+    }
+    uint64_t* obj = ObjectOf(v);
+    if (obj < &m_heap[0] || obj >= &m_heap[0] + m_heap.size()) {
+        return v;
+    }
+    if (obj[0] & 1) {
+        return obj[0] & ~(uint64_t)1;
+    }
+    size_t size = SizeOf(obj);
+    uint64_t* copy = m_to_alloc;
+    memcpy(copy, obj, size * sizeof(uint64_t));
+    m_to_alloc += size;
+    obj[0] = (uint64_t)copy | 1;
+    return (BcValue)copy;
+}
+
+// Copies what is reachable to a new space, twice as large if less than
+// half of it would be free.
+void BcVm::Collect(size_t need) {
+    ++m_collections;
+    CopyLive(m_heap.size());
+    size_t live = m_alloc - &m_heap[0];
+    if (2 * (live + need) > m_heap.size()) {
+        CopyLive(std::max(2 * m_heap.size(), 4 * (live + need)));
+    }
+}
+
+void BcVm::CopyLive(size_t size) {
+    m_to_space.assign(size, 0);
+    m_to_alloc = &m_to_space[0];
+
+    for (BcValue* v = &m_stack[0]; v < m_sp; ++v) {
+        *v = Forward(*v);
+    }
+    for (Frame& frame : m_frames) {
+        frame.self = Forward(frame.self);
+    }
+    m_acc = Forward(m_acc);
+    m_self = Forward(m_self);
+
+    for (uint64_t* scan = &m_to_space[0]; scan < m_to_alloc; scan += SizeOf(scan)) {
+        if (HeaderTag(scan) == m_program.string_tag) {
+            continue;
+        }
+        for (size_t i = 1; i < SizeOf(scan); ++i) {
+            scan[i] = Forward(scan[i]);
+        }
+    }
+
+    m_heap.swap(m_to_space);
+    m_alloc = m_to_alloc;
+}
+
+BcValue BcVm::NewObject(int tag) {
+    if (tag == m_program.int_tag) {
+        return MakeInt(0);
+    }
+    if (tag == m_program.bool_tag) {
+        return MakeBool(false);
+    }
+    if (tag == m_program.string_tag) {
+        return NewString("", 0);
+    }
+    const BcClass& bc_class = m_program.classes[tag];
+    uint64_t* obj = Allocate(tag, 1 + bc_class.attrs.size());
+    for (size_t i = 0; i < bc_class.attrs.size(); ++i) {
+        obj[1 + i] = bc_class.attrs[i] == -1 ? BC_VOID : m_consts[bc_class.attrs[i]];
+    }
+    return (BcValue)obj;
+}
+
+BcValue BcVm::NewString(const char* chars, int len) {
+    uint64_t* obj = Allocate(m_program.string_tag, StringSize(len));
+    obj[1] = MakeInt(len);
+    memcpy(obj + 2, chars, len);
+    memset((char*)(obj + 2) + len, 0, (SizeOf(obj) - 2) * sizeof(uint64_t) - len);
+    return (BcValue)obj;
+}
+
+BcValue BcVm::CopyObject(BcValue obj) {
+    if (!IsObject(obj)) {
+        return obj;
+    }
+    size_t size = SizeOf(ObjectOf(obj));
+    m_acc = obj;
+    uint64_t* copy = Allocate(HeaderTag(ObjectOf(obj)), size);
+    memcpy(copy + 1, ObjectOf(m_acc) + 1, (size - 1) * sizeof(uint64_t));
+    return (BcValue)copy;
+}
+
+// Runs the method of the runtime with m_acc as self and args as the
+// actuals, leaving the result in m_acc. Returns false if the program
+// ends.
+bool BcVm::RunNative(BcNative native, BcValue* args) {
+    switch (native) {
+    case BC_OBJECT_ABORT:
+        m_out << "Abort called from class " << ClassNameOf(m_acc) << std::endl;
+        return false;
+    case BC_OBJECT_TYPE_NAME:
+        m_acc = m_consts[m_program.classes[TagOf(m_acc)].name_const];
+        return true;
+    case BC_OBJECT_COPY:
+        m_acc = CopyObject(m_acc);
+        return true;
+    case BC_IO_OUT_STRING:
+        m_out.write(StringChars(args[0]), StringLen(args[0]));
+        return true;
+    case BC_IO_OUT_INT:
+        m_out << IntVal(args[0]);
+        return true;
+    case BC_IO_IN_STRING: {
+        std::string line;
+        m_out.flush();
+        std::getline(std::cin, line);
+        m_acc = NewString(line.data(), line.size());
+        return true;
+    }
+    case BC_IO_IN_INT: {
+        std::string line;
+        m_out.flush();
+        std::getline(std::cin, line);
+        m_acc = MakeInt(atoi(line.c_str()));
+        return true;
+    }
+    case BC_STRING_LENGTH:
+        m_acc = ObjectOf(m_acc)[1];
+        return true;
+    case BC_STRING_CONCAT: {
+        std::string str = StringOf(m_acc) + StringOf(args[0]);
+        m_acc = NewString(str.data(), str.size());
+        return true;
+    }
+    case BC_STRING_SUBSTR: {
+        int start = IntVal(args[0]);
+        int len = IntVal(args[1]);
+        if (start < 0 || len < 0 || start + len > StringLen(m_acc)) {
+            m_out << "Index to substr is out of range" << std::endl;
+            return false;
+        }
+        std::string str = StringOf(m_acc).substr(start, len);
+        m_acc = NewString(str.data(), str.size());
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+int BcVm::Run() {
+    int status = m_count_ops ? Execute<true>() : Execute<false>();
+    m_out.flush();
+    if (status == 0) {
+        std::cerr << "COOL program successfully executed" << std::endl;
+    }
+    if (m_count_ops) {
+        ReportCounts();
+    }
+    return status;
+}
+
+void BcVm::ReportCounts() {
+    static const char* const names[] = {
+#define BC_NAME(name, operand_num) #name,
+        BC_OPCODES(BC_NAME)
+#undef BC_NAME
+    };
+    std::vector<int> ops;
+    uint64_t total = 0;
+    for (int op = 0; op < BC_OP_NUM; ++op) {
+        ops.push_back(op);
+        total += m_op_counts[op];
+    }
+    std::stable_sort(ops.begin(), ops.end(), [this](int a, int b) {
+        return m_op_counts[a] > m_op_counts[b];
+    });
+
+    std::cerr << "Stats -- #ops          : " << total << std::endl
+              << "         #collections  : " << m_collections << std::endl;
+    for (int op : ops) {
+        if (m_op_counts[op] != 0) {
+            std::cerr << "\t" << names[op] << "\t" << m_op_counts[op] << std::endl;
+        }
+    }
+}
+
+// Each opcode has two entries: one that counts it and then falls into
+// the one that runs it.
+#define OP(name) count_##name: ++m_op_counts[BC_##name]; op_##name:
+#define NEXT() goto **pc++
+#define OPERAND(i) ((intptr_t)pc[i])
+#define SAVE() (m_sp = sp, m_acc = acc, m_self = self)
+#define RESTORE() (acc = m_acc, self = m_self)
+
+template <bool COUNT>
+int BcVm::Execute() {
+    static const void* const op_labels[] = {
+#define BC_LABEL(name, operand_num) &&op_##name,
+        BC_OPCODES(BC_LABEL)
+#undef BC_LABEL
+    };
+    static const void* const count_labels[] = {
+#define BC_LABEL(name, operand_num) &&count_##name,
+        BC_OPCODES(BC_LABEL)
+#undef BC_LABEL
+    };
+    static const int operand_nums[] = {
+#define BC_OPERAND_NUM(name, operand_num) operand_num,
+        BC_OPCODES(BC_OPERAND_NUM)
+#undef BC_OPERAND_NUM
+    };
+    const void* const* labels = COUNT ? count_labels : op_labels;
+
+    // The program starts with new Main.main(), which returns to nullptr.
+    std::vector<int> start = { BC_NEW, m_program.main_class, BC_CALL, m_program.main_method, 0, 0,
+                               BC_RETURN };
+    std::vector<const void*> threaded;
+    const std::vector<int>* codes[] = { &m_program.code, &start };
+    for (const std::vector<int>* code : codes) {
+        for (size_t i = 0; i < code->size(); ) {
+            int op = (*code)[i];
+            threaded.push_back(labels[op]);
+            for (int k = 1; k <= operand_nums[op]; ++k) {
+                threaded.push_back((const void*)(intptr_t)(*code)[i + k]);
+            }
+            i += 1 + operand_nums[op];
+        }
+    }
+    const void* const* base = &threaded[0];
+    const BcValue* stack_limit = &m_stack[0] + m_stack.size();
+
+    BcValue* sp = &m_stack[0];
+    BcValue* fp = sp;
+    BcValue acc = BC_VOID;
+    BcValue self = BC_VOID;
+    int method = -1;
+    int callee;
+    int nargs;
+    const void* const* pc = base + m_program.code.size();
+    m_frames.push_back(Frame { nullptr, fp, self, method });
+    NEXT();
+
+    OP(LOAD_VOID) {
+        acc = BC_VOID;
+        NEXT();
+    }
+    OP(LOAD_SELF) {
+        acc = self;
+        NEXT();
+    }
+    OP(LOAD_CONST) {
+        acc = m_consts[OPERAND(0)];
+        pc += 1;
+        NEXT();
+    }
+    OP(LOAD_LOCAL) {
+        acc = fp[OPERAND(0)];
+        pc += 1;
+        NEXT();
+    }
+    OP(STORE_LOCAL) {
+        fp[OPERAND(0)] = acc;
+        pc += 1;
+        NEXT();
+    }
+    OP(LOAD_ATTR) {
+        acc = ObjectOf(self)[1 + OPERAND(0)];
+        pc += 1;
+        NEXT();
+    }
+    OP(STORE_ATTR) {
+        ObjectOf(self)[1 + OPERAND(0)] = acc;
+        pc += 1;
+        NEXT();
+    }
+    OP(PUSH) {
+        *sp++ = acc;
+        NEXT();
+    }
+    OP(ADD) {
+        acc = MakeInt((int32_t)((uint32_t)IntVal(*--sp) + (uint32_t)IntVal(acc)));
+        NEXT();
+    }
+    OP(SUB) {
+        acc = MakeInt((int32_t)((uint32_t)IntVal(*--sp) - (uint32_t)IntVal(acc)));
+        NEXT();
+    }
+    OP(MUL) {
+        acc = MakeInt((int32_t)((uint32_t)IntVal(*--sp) * (uint32_t)IntVal(acc)));
+        NEXT();
+    }
+    OP(DIV) {
+        int32_t x = IntVal(*--sp);
+        int32_t y = IntVal(acc);
+        if (y == 0) {
+            m_out.flush();
+            std::cerr << "Division by zero" << std::endl;
+            return 1;
+        }
+        acc = MakeInt(y == -1 ? (int32_t)(0 - (uint32_t)x) : x / y);
+        NEXT();
+    }
+    OP(NEG) {
+        acc = MakeInt((int32_t)(0 - (uint32_t)IntVal(acc)));
+        NEXT();
+    }
+    OP(LT) {
+        acc = MakeBool(IntVal(*--sp) < IntVal(acc));
+        NEXT();
+    }
+    OP(LEQ) {
+        acc = MakeBool(IntVal(*--sp) <= IntVal(acc));
+        NEXT();
+    }
+    OP(EQ) {
+        BcValue other = *--sp;
+        bool equal = other == acc;
+        if (!equal && IsObject(other) && IsObject(acc) &&
+            TagOf(other) == m_program.string_tag && TagOf(acc) == m_program.string_tag) {
+            equal = StringLen(other) == StringLen(acc) &&
+                    memcmp(StringChars(other), StringChars(acc), StringLen(acc)) == 0;
+        }
+        acc = MakeBool(equal);
+        NEXT();
+    }
+    OP(NOT) {
+        acc = MakeBool(acc == MakeBool(false));
+        NEXT();
+    }
+    OP(ISVOID) {
+        acc = MakeBool(acc == BC_VOID);
+        NEXT();
+    }
+    OP(JUMP) {
+        pc = base + OPERAND(0);
+        NEXT();
+    }
+    OP(JUMP_FALSE) {
+        pc = acc == MakeBool(false) ? base + OPERAND(0) : pc + 1;
+        NEXT();
+    }
+    OP(JUMP_TAG_OUT) {
+        int tag = TagOf(acc);
+        pc = tag < OPERAND(0) || tag > OPERAND(1) ? base + OPERAND(2) : pc + 3;
+        NEXT();
+    }
+    OP(CASE_VOID) {
+        if (acc == BC_VOID) {
+            m_out << FilenameOf(method) << ":" << OPERAND(0)
+                  << ": Match on void in case statement." << std::endl;
+            return 1;
+        }
+        pc += 1;
+        NEXT();
+    }
+    OP(CASE_ABORT) {
+        m_out << "No match in case statement for Class " << ClassNameOf(acc) << std::endl;
+        return 1;
+    }
+    OP(NEW) {
+        int tag = OPERAND(0);
+        pc += 1;
+        SAVE();
+        acc = NewObject(tag);
+        self = m_self;
+        callee = m_program.classes[tag].init;
+        if (callee == -1) {
+            NEXT();
+        }
+        nargs = 0;
+        goto call;
+    }
+    OP(NEW_SELF) {
+        int tag = TagOf(self);
+        SAVE();
+        acc = NewObject(tag);
+        self = m_self;
+        callee = m_program.classes[tag].init;
+        if (callee == -1) {
+            NEXT();
+        }
+        nargs = 0;
+        goto call;
+    }
+    OP(DISPATCH) {
+        if (acc == BC_VOID) {
+            goto dispatch_abort;
+        }
+        callee = m_program.classes[TagOf(acc)].disp[OPERAND(0)];
+        nargs = OPERAND(1);
+        pc += 3;
+        goto call;
+    }
+    OP(CALL) {
+        if (acc == BC_VOID) {
+            goto dispatch_abort;
+        }
+        callee = OPERAND(0);
+        nargs = OPERAND(1);
+        pc += 3;
+        goto call;
+    }
+    OP(RETURN) {
+        const Frame& frame = m_frames.back();
+        sp = fp;
+        pc = frame.pc;
+        fp = frame.fp;
+        self = frame.self;
+        method = frame.method;
+        m_frames.pop_back();
+        if (pc == nullptr) {
+            return 0;
+        }
+        NEXT();
+    }
+
+    // Calls callee on acc with the nargs actuals on top of the stack, which
+    // the callee pops.
+call:
+    {
+        const BcMethod& bc_method = m_program.methods[callee];
+        if (bc_method.native != BC_NOT_NATIVE) {
+            SAVE();
+            if (!RunNative(bc_method.native, sp - nargs)) {
+                return 1;
+            }
+            RESTORE();
+            sp -= nargs;
+            NEXT();
+        }
+        // Room for the slots and for whatever the method pushes, so that
+        // PUSH need not check.
+        if (m_frames.size() == FRAME_NUM ||
+            sp + bc_method.slot_num + bc_method.push_num > stack_limit) {
+            m_out.flush();
+            std::cerr << "Stack overflow" << std::endl;
+            return 1;
+        }
+        m_frames.push_back(Frame { pc, fp, self, method });
+        fp = sp - nargs;
+        for (int i = 0; i < bc_method.slot_num; ++i) {
+            *sp++ = BC_VOID;
+        }
+        self = acc;
+        method = callee;
+        pc = base + bc_method.entry;
+        NEXT();
+    }
+
+dispatch_abort:
+    m_out << FilenameOf(method) << ":" << OPERAND(2) << ": Dispatch to void." << std::endl;
+    return 1;
+}
+
+#undef OP
+#undef NEXT
+#undef OPERAND
+#undef SAVE
+#undef RESTORE
+
+int RunBytecode(const BcProgram& program, std::ostream& out, bool count_ops) {
+    BcVm vm(program, out, count_ops);
+    return vm.Run();
+}